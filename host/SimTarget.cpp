@@ -0,0 +1,941 @@
+#include "SimTarget.h"
+
+#include <string.h>
+
+#include "debug_defines.h"
+
+// WCH-specific debug module registers
+static const uint32_t WCH_DM_CPBR     = 0x7C;
+static const uint32_t WCH_DM_CFGR     = 0x7D;
+static const uint32_t WCH_DM_SHDWCFGR = 0x7E;
+static const uint32_t WCH_DM_PART     = 0x7F;
+
+static const uint32_t part_ch32v003   = 0x00300500;
+
+// HARTINFO - DATAADDR 0x0F4, DATASIZE 2, DATAACCESS 1 (memory mapped), NSCRATCH 2
+static const uint32_t hartinfo_value  = 0x002120F4;
+
+// Flash controller
+static const uint32_t flash_regs      = 0x40022000;
+static const uint32_t FLASH_ACTLR     = 0x00;
+static const uint32_t FLASH_KEYR      = 0x04;
+static const uint32_t FLASH_OBKEYR    = 0x08;
+static const uint32_t FLASH_STATR     = 0x0C;
+static const uint32_t FLASH_CTLR      = 0x10;
+static const uint32_t FLASH_ADDR      = 0x14;
+static const uint32_t FLASH_OBR       = 0x1C;
+static const uint32_t FLASH_WPR       = 0x20;
+static const uint32_t FLASH_MKEYR     = 0x24;
+
+static const uint32_t FLASH_KEY1      = 0x45670123;
+static const uint32_t FLASH_KEY2      = 0xCDEF89AB;
+
+static const uint32_t CTLR_PG         = (1 <<  0);
+static const uint32_t CTLR_PER        = (1 <<  1);
+static const uint32_t CTLR_MER        = (1 <<  2);
+static const uint32_t CTLR_STRT       = (1 <<  6);
+static const uint32_t CTLR_LOCK       = (1 <<  7);
+static const uint32_t CTLR_FLOCK      = (1 << 15);
+static const uint32_t CTLR_FTPG       = (1 << 16);
+static const uint32_t CTLR_FTER       = (1 << 17);
+static const uint32_t CTLR_BUFLOAD    = (1 << 18);
+static const uint32_t CTLR_BUFRST     = (1 << 19);
+
+static const uint32_t STATR_WRPRTERR  = (1 <<  4);
+static const uint32_t STATR_EOP       = (1 <<  5);
+
+// Electronic signature - flash capacity and unique ID
+static const uint32_t esig_base       = 0x1FFFF7E0;
+static const uint32_t esig_words[5]   = { 0x00000010, 0x00000000, 0xCD0A8B51, 0x73BC6D4A, 0xFFFFFFFF };
+
+// DCSR fields
+static const uint32_t DCSR_EBREAKM    = (1 << 15);
+static const uint32_t DCSR_STEP       = (1 <<  2);
+static const uint32_t DCSR_RESET      = 0x40000003; // XDEBUGVER 4, PRV machine
+
+static const int CAUSE_EBREAK         = 1;
+static const int CAUSE_HALTREQ        = 3;
+static const int CAUSE_STEP           = 4;
+
+// CMDERR values
+static const uint32_t ERR_NOTSUP      = 2;
+static const uint32_t ERR_EXCEPTION   = 3;
+static const uint32_t ERR_HALTRESUME  = 4;
+
+// Runaway limit for a single progbuf run
+static const int progbuf_max_insns    = 1000000;
+
+//------------------------------------------------------------------------------
+
+SimTarget::SimTarget() {
+  memset(flash, 0xFF, sizeof(flash));
+  power_on();
+}
+
+void SimTarget::power_on() {
+  memset(ram, 0, sizeof(ram));
+  cfgr = 0;
+  shdwcfgr = 0;
+  reset_dm();
+  reset_hart();
+  havereset = false;
+  reset_counters();
+}
+
+void SimTarget::reset_counters() {
+  stats.reset();
+  wire_ns = 0;
+  insn_count = 0;
+}
+
+//------------------------------------------------------------------------------
+// Standard mode bit times from singlewire.pio at PicoSWIO's default 96 ns
+// tick, rounded - a short pulse plus pull-up is 500 ns, a long one 1100 ns,
+// each read bit takes 1100 ns and the start bit plus the stop gap cost about
+// 3300 ns per frame.
+
+uint32_t SimTarget::frame_ns(uint32_t addr, bool write, uint32_t data) {
+  const uint32_t ns_short = 500;
+  const uint32_t ns_long  = 1100;
+  const uint32_t ns_read  = 1100;
+  const uint32_t ns_frame = 3300;
+
+  uint32_t cmd = (((~addr) << 1) | (write ? 0 : 1)) & 0xFF;
+  int cmd_long = __builtin_popcount(cmd);
+  uint32_t t = ns_frame + cmd_long * ns_long + (8 - cmd_long) * ns_short;
+
+  if (write) {
+    int data_long = __builtin_popcount(~data);
+    t += data_long * ns_long + (32 - data_long) * ns_short;
+  }
+  else {
+    t += 32 * ns_read;
+  }
+  return t;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t SimTarget::get(uint32_t addr) {
+  run_hart(run_per_op);
+
+  uint32_t result = 0;
+
+  if (addr >= DM_PROGBUF0 && addr <= DM_PROGBUF15) {
+    if (int(addr - DM_PROGBUF0) < progbuf_size) result = progbuf[addr - DM_PROGBUF0];
+  }
+  else switch (addr) {
+    case DM_DATA0: result = data0; break;
+    case DM_DATA1: result = data_count > 1 ? data1 : 0; break;
+
+    case DM_DMCONTROL: result = dmcontrol; break;
+
+    case DM_DMSTATUS:
+      result = 2 | (1 << 7);                        // version 0.13, authenticated
+      result |= halted ? (3 << 8) : (3 << 10);      // any/all halted or running
+      if (resumeack) result |= (3 << 16);
+      if (havereset) result |= (3 << 18);
+      break;
+
+    case DM_HARTINFO:
+      result = (hartinfo_value & ~0x1F000) | (data_count << 12) | (data_mapped ? 0x10000 : 0);
+      break;
+    case DM_ABSTRACTCS:   result = (progbuf_size << 24) | (cmderr << 8) | data_count; break;
+    case DM_COMMAND:      result = command; break;
+    case DM_ABSTRACTAUTO: result = abstractauto; break;
+    case DM_HALTSUM0:     result = halted ? 1 : 0; break;
+
+    case WCH_DM_CPBR:     result = 0x00010000 | (cfgr & 0x7F); break;
+    case WCH_DM_CFGR:     result = cfgr; break;
+    case WCH_DM_SHDWCFGR: result = shdwcfgr; break;
+    case WCH_DM_PART:     result = part_ch32v003; break;
+  }
+
+  // Reading DATA0 with autoexec set reruns the last command after the read.
+  if (addr == DM_DATA0 && (abstractauto & 1)) exec_command();
+  if (addr == DM_DATA1 && data_count > 1 && (abstractauto & 2)) exec_command();
+  if (addr >= DM_PROGBUF0 && addr <= DM_PROGBUF15 && (abstractauto & (1 << (16 + addr - DM_PROGBUF0)))) {
+    exec_command();
+  }
+
+  stats.on_get(addr);
+  uint32_t ns = frame_ns(addr, false, result);
+  stats.on_call(DMIStats::GET, ns / 1000);
+  wire_ns += ns;
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+void SimTarget::put(uint32_t addr, uint32_t data) {
+  run_hart(run_per_op);
+
+  stats.on_put(addr);
+  uint32_t ns = frame_ns(addr, true, data);
+  stats.on_call(DMIStats::PUT, ns / 1000);
+  wire_ns += ns;
+
+  if (addr >= DM_PROGBUF0 && addr <= DM_PROGBUF15) {
+    if (int(addr - DM_PROGBUF0) >= progbuf_size) return;
+    progbuf[addr - DM_PROGBUF0] = data;
+    if (abstractauto & (1 << (16 + addr - DM_PROGBUF0))) exec_command();
+    return;
+  }
+
+  switch (addr) {
+    case DM_DATA0:
+      data0 = data;
+      if (abstractauto & 1) exec_command();
+      break;
+
+    case DM_DATA1:
+      if (data_count < 2) break;
+      data1 = data;
+      if (abstractauto & 2) exec_command();
+      break;
+
+    case DM_DMCONTROL: {
+      if (!(data & 1)) {
+        reset_dm();
+        break;
+      }
+      dmcontrol = data & 0x80000003;
+
+      bool haltreq   = data & (1u << 31);
+      bool resumereq = data & (1u << 30);
+      bool ackreset  = data & (1u << 28);
+      bool ndmreset  = data & (1u << 1);
+
+      if (ndmreset) {
+        reset_hart();
+        havereset = true;
+      }
+      if (ackreset) havereset = false;
+
+      if (haltreq) {
+        if (!halted) enter_debug(CAUSE_HALTREQ);
+      }
+      else if (resumereq && halted && !ndmreset) {
+        resume_hart();
+      }
+      break;
+    }
+
+    case DM_ABSTRACTCS:
+      cmderr &= ~((data >> 8) & 7);
+      break;
+
+    case DM_COMMAND:
+      // Writing COMMAND while CMDERR is set is ignored, same as hardware.
+      if (cmderr) break;
+      command = data;
+      exec_command();
+      break;
+
+    case DM_ABSTRACTAUTO:
+      abstractauto = data & 0xFFFF0FFF;
+      break;
+
+    case WCH_DM_CFGR:
+      if ((data >> 16) == 0x5AA5) cfgr = data & 0xFFFF;
+      break;
+
+    case WCH_DM_SHDWCFGR:
+      if ((data >> 16) == 0x5AA5) shdwcfgr = data & 0xFFFF;
+      break;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+void SimTarget::reset_dm() {
+  data0 = 0;
+  data1 = 0;
+  for (int i = 0; i < 16; i++) progbuf[i] = 0;
+  dmcontrol = 0;
+  command = 0;
+  abstractauto = 0;
+  cmderr = 0;
+  resumeack = false;
+}
+
+void SimTarget::reset_hart() {
+  for (int i = 0; i < 16; i++) gpr[i] = 0;
+  pc = 0;
+  halted = false;
+  hung = false;
+  dcsr = DCSR_RESET;
+  dpc = 0;
+  dscratch0 = 0;
+  dscratch1 = 0;
+  csrs.clear();
+
+  flash_ctlr = CTLR_LOCK | CTLR_FLOCK;
+  flash_statr = 0;
+  flash_addr = 0;
+  flash_actlr = 0;
+  keyr_stage = 0;
+  mkeyr_stage = 0;
+  memset(page_buf, 0xFF, sizeof(page_buf));
+}
+
+void SimTarget::enter_debug(int cause) {
+  halted = true;
+  dpc = pc;
+  dcsr = (dcsr & ~(7 << 6)) | (cause << 6);
+}
+
+//------------------------------------------------------------------------------
+// Resuming with DCSR.STEP set runs exactly one instruction and halts again.
+
+void SimTarget::resume_hart() {
+  halted = false;
+  resumeack = true;
+  pc = dpc;
+
+  if (dcsr & DCSR_STEP) {
+    Trap trap = hung ? TRAP_FAULT : step_hart();
+    if (trap == TRAP_EBREAK) {
+      enter_debug(CAUSE_EBREAK);
+    }
+    else {
+      if (trap == TRAP_FAULT) hung = true;
+      enter_debug(CAUSE_STEP);
+    }
+  }
+}
+
+void SimTarget::run_hart(int count) {
+  for (int i = 0; i < count; i++) {
+    if (halted || hung) return;
+
+    uint32_t old_pc = pc;
+    Trap trap = step_hart();
+    if (trap == TRAP_EBREAK) {
+      if (dcsr & DCSR_EBREAKM) {
+        pc = old_pc;
+        enter_debug(CAUSE_EBREAK);
+      }
+      else {
+        hung = true;
+      }
+    }
+    else if (trap == TRAP_FAULT) {
+      hung = true;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Access register commands only, 32-bit transfers only.
+
+void SimTarget::exec_command() {
+  if (cmderr) return;
+
+  uint32_t cmdtype  = command >> 24;
+  uint32_t aarsize  = (command >> 20) & 7;
+  bool     postexec = command & (1 << 18);
+  bool     transfer = command & (1 << 17);
+  bool     write    = command & (1 << 16);
+  uint32_t regno    = command & 0xFFFF;
+
+  if (cmdtype != 0) {
+    cmderr = ERR_NOTSUP;
+    return;
+  }
+  if (!halted) {
+    cmderr = ERR_HALTRESUME;
+    return;
+  }
+
+  if (transfer) {
+    if (aarsize != 2) {
+      cmderr = ERR_NOTSUP;
+      return;
+    }
+    bool ok = write ? set_reg(regno, data0) : get_reg(regno, data0);
+    if (!ok) {
+      cmderr = ERR_EXCEPTION;
+      return;
+    }
+  }
+
+  if (postexec) run_progbuf();
+}
+
+//------------------------------------------------------------------------------
+// The progbuf runs with an implicit ebreak after its last word.
+
+void SimTarget::run_progbuf() {
+  uint32_t saved_pc = pc;
+  pc = progbuf_base;
+
+  for (int i = 0; i < progbuf_max_insns; i++) {
+    if (pc == progbuf_base + progbuf_size * 4) break;
+    Trap trap = step_hart();
+    if (trap == TRAP_EBREAK) break;
+    if (trap == TRAP_FAULT) {
+      cmderr = ERR_EXCEPTION;
+      break;
+    }
+  }
+
+  pc = saved_pc;
+}
+
+//------------------------------------------------------------------------------
+
+bool SimTarget::get_reg(uint32_t regno, uint32_t& value) {
+  if (regno >= 0x1000 && regno < 0x1010) {
+    value = gpr[regno - 0x1000];
+    return true;
+  }
+  if (regno < 0x1000) {
+    uint32_t old;
+    if (!csr_op(regno, 0, 0, false, old)) return false;
+    value = old;
+    return true;
+  }
+  return false;
+}
+
+bool SimTarget::set_reg(uint32_t regno, uint32_t value) {
+  if (regno >= 0x1000 && regno < 0x1010) {
+    if (regno != 0x1000) gpr[regno - 0x1000] = value;
+    return true;
+  }
+  if (regno < 0x1000) {
+    uint32_t old;
+    return csr_op(regno, 1, value, true, old);
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// op 1 = write, 2 = set bits, 3 = clear bits.
+
+bool SimTarget::csr_op(uint32_t csr, int op, uint32_t src, bool write, uint32_t& old) {
+  uint32_t* reg = nullptr;
+  switch (csr) {
+    case CSR_DCSR:      reg = &dcsr; break;
+    case CSR_DPC:       reg = &dpc; break;
+    case CSR_DSCRATCH0: reg = &dscratch0; break;
+    case CSR_DSCRATCH1: reg = &dscratch1; break;
+    case 0x301:         old = 0x40800014; return true; // misa - RV32ECX, read-only
+    default:            reg = &csrs[csr]; break;
+  }
+
+  old = *reg;
+  if (!write) return true;
+
+  switch (op) {
+    case 1: *reg = src; break;
+    case 2: *reg |= src; break;
+    case 3: *reg &= ~src; break;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool SimTarget::fetch16(uint32_t addr, uint32_t& out) {
+  if (addr & 1) return false;
+  if (addr >= progbuf_base && addr < progbuf_base + progbuf_size * 4) {
+    uint32_t word = progbuf[(addr - progbuf_base) >> 2];
+    out = (addr & 2) ? (word >> 16) : (word & 0xFFFF);
+    return true;
+  }
+  if (addr >= data_base && addr < data_base + 8) return false;
+  return load(addr, 2, out);
+}
+
+bool SimTarget::load(uint32_t addr, int size, uint32_t& out) {
+  if (addr & (size - 1)) return false;
+
+  const uint8_t* src = nullptr;
+  if (addr < flash_size) {
+    src = flash + addr;
+  }
+  else if (addr >= flash_base && addr - flash_base < flash_size) {
+    src = flash + (addr - flash_base);
+  }
+  else if (addr >= ram_base && addr - ram_base < ram_size) {
+    src = ram + (addr - ram_base);
+  }
+  else if (addr >= esig_base && addr - esig_base < sizeof(esig_words)) {
+    src = (const uint8_t*)esig_words + (addr - esig_base);
+  }
+  else if (addr >= flash_regs && addr - flash_regs < 0x30) {
+    if (size != 4) return false;
+    out = get_flash_reg(addr - flash_regs);
+    return true;
+  }
+  else if (data_mapped && addr == data_base && size == 4) {
+    out = data0;
+    return true;
+  }
+  else if (data_mapped && data_count > 1 && addr == data_base + 4 && size == 4) {
+    out = data1;
+    return true;
+  }
+  else {
+    return false;
+  }
+
+  out = 0;
+  memcpy(&out, src, size);
+  return true;
+}
+
+bool SimTarget::store(uint32_t addr, int size, uint32_t data) {
+  if (addr & (size - 1)) return false;
+
+  if (addr >= ram_base && addr - ram_base < ram_size) {
+    memcpy(ram + (addr - ram_base), &data, size);
+    return true;
+  }
+
+  // Stores to flash only do something in fast programming mode, where they
+  // fill the page buffer.
+  uint32_t flash_offset = 0xFFFFFFFF;
+  if (addr < flash_size) flash_offset = addr;
+  if (addr >= flash_base && addr - flash_base < flash_size) flash_offset = addr - flash_base;
+  if (flash_offset != 0xFFFFFFFF) {
+    if ((flash_ctlr & CTLR_FTPG) && size == 4) {
+      memcpy(page_buf + (flash_offset & 63), &data, 4);
+    }
+    return true;
+  }
+
+  if (addr >= flash_regs && addr - flash_regs < 0x30) {
+    if (size != 4) return false;
+    set_flash_reg(addr - flash_regs, data);
+    return true;
+  }
+  if (data_mapped && addr == data_base && size == 4) {
+    data0 = data;
+    return true;
+  }
+  if (data_mapped && data_count > 1 && addr == data_base + 4 && size == 4) {
+    data1 = data;
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// The real controller is never BUSY by the time the next DMI op arrives, so
+// operations complete immediately and just set EOP.
+
+uint32_t SimTarget::get_flash_reg(uint32_t offset) {
+  switch (offset) {
+    case FLASH_ACTLR: return flash_actlr;
+    case FLASH_STATR: return flash_statr;
+    case FLASH_CTLR:  return flash_ctlr;
+    case FLASH_ADDR:  return flash_addr;
+    case FLASH_OBR:   return 0x03FFFFFE;
+    case FLASH_WPR:   return 0xFFFFFFFF;
+  }
+  return 0;
+}
+
+void SimTarget::set_flash_reg(uint32_t offset, uint32_t data) {
+  switch (offset) {
+    case FLASH_ACTLR:
+      flash_actlr = data;
+      break;
+
+    case FLASH_KEYR:
+      if (data == FLASH_KEY1) {
+        keyr_stage = 1;
+      }
+      else if (data == FLASH_KEY2 && keyr_stage == 1) {
+        flash_ctlr &= ~CTLR_LOCK;
+        keyr_stage = 0;
+      }
+      else {
+        keyr_stage = 0;
+      }
+      break;
+
+    case FLASH_MKEYR:
+      if (data == FLASH_KEY1) {
+        mkeyr_stage = 1;
+      }
+      else if (data == FLASH_KEY2 && mkeyr_stage == 1) {
+        flash_ctlr &= ~CTLR_FLOCK;
+        mkeyr_stage = 0;
+      }
+      else {
+        mkeyr_stage = 0;
+      }
+      break;
+
+    case FLASH_OBKEYR:
+      break;
+
+    case FLASH_STATR:
+      flash_statr &= ~(data & (STATR_EOP | STATR_WRPRTERR));
+      break;
+
+    case FLASH_ADDR:
+      flash_addr = data;
+      break;
+
+    case FLASH_CTLR: {
+      // LOCK and FLOCK can only be set by writing, not cleared.
+      uint32_t locks = (flash_ctlr | data) & (CTLR_LOCK | CTLR_FLOCK);
+      uint32_t ops = data & (CTLR_PG | CTLR_PER | CTLR_MER | CTLR_FTPG | CTLR_FTER);
+
+      bool locked = locks & CTLR_LOCK;
+      bool fast_locked = locks & CTLR_FLOCK;
+      if ((ops && locked) || ((data & (CTLR_FTPG | CTLR_FTER)) && fast_locked)) {
+        flash_statr |= STATR_WRPRTERR;
+        flash_ctlr = locks | (flash_ctlr & ~(CTLR_LOCK | CTLR_FLOCK));
+        break;
+      }
+
+      flash_ctlr = locks | ops;
+
+      if (data & CTLR_BUFRST) memset(page_buf, 0xFF, sizeof(page_buf));
+
+      if (data & CTLR_STRT) {
+        uint32_t offset = flash_addr & (flash_size - 1);
+        if (ops & CTLR_FTER) {
+          memset(flash + (offset & ~63), 0xFF, 64);
+        }
+        else if (ops & CTLR_PER) {
+          memset(flash + (offset & ~1023), 0xFF, 1024);
+        }
+        else if (ops & CTLR_MER) {
+          memset(flash, 0xFF, flash_size);
+        }
+        else if (ops & CTLR_FTPG) {
+          memcpy(flash + (offset & ~63), page_buf, 64);
+        }
+        flash_statr |= STATR_EOP;
+      }
+      break;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
+SimTarget::Trap SimTarget::step_hart() {
+  uint32_t lo, hi;
+  if (!fetch16(pc, lo)) return TRAP_FAULT;
+  insn_count++;
+  if ((lo & 3) != 3) return exec16(lo);
+  if (!fetch16(pc + 2, hi)) return TRAP_FAULT;
+  return exec32(lo | (hi << 16));
+}
+
+//------------------------------------------------------------------------------
+
+static int32_t sext(uint32_t x, int bits) {
+  return int32_t(x << (32 - bits)) >> (32 - bits);
+}
+
+SimTarget::Trap SimTarget::exec32(uint32_t i) {
+  uint32_t opcode = i & 0x7F;
+  uint32_t rd  = (i >>  7) & 31;
+  uint32_t f3  = (i >> 12) & 7;
+  uint32_t rs1 = (i >> 15) & 31;
+  uint32_t rs2 = (i >> 20) & 31;
+  uint32_t f7  = i >> 25;
+
+  // RV32E only has x0-x15. Which fields are registers depends on the format.
+  bool uses_rd  = opcode != 0x63 && opcode != 0x23 && opcode != 0x0F;
+  bool uses_rs1 = opcode != 0x37 && opcode != 0x17 && opcode != 0x6F && opcode != 0x0F && !(opcode == 0x73 && (f3 & 4));
+  bool uses_rs2 = opcode == 0x63 || opcode == 0x23 || opcode == 0x33;
+  if ((uses_rd && rd > 15) || (uses_rs1 && rs1 > 15) || (uses_rs2 && rs2 > 15)) return TRAP_FAULT;
+
+  auto x = [&](uint32_t r) { return r < 16 ? gpr[r] : 0; };
+  auto set_x = [&](uint32_t r, uint32_t v) { if (r) gpr[r] = v; };
+
+  int32_t imm_i = int32_t(i) >> 20;
+  int32_t imm_s = ((int32_t(i) >> 25) << 5) | ((i >> 7) & 0x1F);
+  int32_t imm_b = sext(((i >> 31) << 12) | (((i >> 7) & 1) << 11) | (((i >> 25) & 0x3F) << 5) | (((i >> 8) & 0xF) << 1), 13);
+  int32_t imm_j = sext(((i >> 31) << 20) | (i & 0xFF000) | (((i >> 20) & 1) << 11) | (((i >> 21) & 0x3FF) << 1), 21);
+  uint32_t imm_u = i & 0xFFFFF000;
+
+  uint32_t next = pc + 4;
+
+  switch (opcode) {
+    case 0x37: set_x(rd, imm_u); break;
+    case 0x17: set_x(rd, pc + imm_u); break;
+
+    case 0x6F:
+      set_x(rd, next);
+      next = pc + imm_j;
+      break;
+
+    case 0x67: {
+      uint32_t target = (x(rs1) + imm_i) & ~1;
+      set_x(rd, next);
+      next = target;
+      break;
+    }
+
+    case 0x63: {
+      uint32_t a = x(rs1), b = x(rs2);
+      bool taken;
+      switch (f3) {
+        case 0: taken = a == b; break;
+        case 1: taken = a != b; break;
+        case 4: taken = int32_t(a) <  int32_t(b); break;
+        case 5: taken = int32_t(a) >= int32_t(b); break;
+        case 6: taken = a <  b; break;
+        case 7: taken = a >= b; break;
+        default: return TRAP_FAULT;
+      }
+      if (taken) next = pc + imm_b;
+      break;
+    }
+
+    case 0x03: {
+      uint32_t addr = x(rs1) + imm_i;
+      uint32_t v;
+      switch (f3) {
+        case 0: if (!load(addr, 1, v)) return TRAP_FAULT; v = sext(v, 8); break;
+        case 1: if (!load(addr, 2, v)) return TRAP_FAULT; v = sext(v, 16); break;
+        case 2: if (!load(addr, 4, v)) return TRAP_FAULT; break;
+        case 4: if (!load(addr, 1, v)) return TRAP_FAULT; break;
+        case 5: if (!load(addr, 2, v)) return TRAP_FAULT; break;
+        default: return TRAP_FAULT;
+      }
+      set_x(rd, v);
+      break;
+    }
+
+    case 0x23: {
+      uint32_t addr = x(rs1) + imm_s;
+      if (f3 > 2) return TRAP_FAULT;
+      if (!store(addr, 1 << f3, x(rs2))) return TRAP_FAULT;
+      break;
+    }
+
+    case 0x13: {
+      uint32_t a = x(rs1);
+      uint32_t shamt = rs2;
+      switch (f3) {
+        case 0: set_x(rd, a + imm_i); break;
+        case 2: set_x(rd, int32_t(a) < imm_i); break;
+        case 3: set_x(rd, a < uint32_t(imm_i)); break;
+        case 4: set_x(rd, a ^ imm_i); break;
+        case 6: set_x(rd, a | imm_i); break;
+        case 7: set_x(rd, a & imm_i); break;
+        case 1:
+          if (f7 != 0) return TRAP_FAULT;
+          set_x(rd, a << shamt);
+          break;
+        case 5:
+          if (f7 == 0x00)      set_x(rd, a >> shamt);
+          else if (f7 == 0x20) set_x(rd, int32_t(a) >> shamt);
+          else return TRAP_FAULT;
+          break;
+      }
+      break;
+    }
+
+    case 0x33: {
+      uint32_t a = x(rs1), b = x(rs2);
+      if (f7 == 0x00) {
+        switch (f3) {
+          case 0: set_x(rd, a + b); break;
+          case 1: set_x(rd, a << (b & 31)); break;
+          case 2: set_x(rd, int32_t(a) < int32_t(b)); break;
+          case 3: set_x(rd, a < b); break;
+          case 4: set_x(rd, a ^ b); break;
+          case 5: set_x(rd, a >> (b & 31)); break;
+          case 6: set_x(rd, a | b); break;
+          case 7: set_x(rd, a & b); break;
+        }
+      }
+      else if (f7 == 0x20 && f3 == 0) set_x(rd, a - b);
+      else if (f7 == 0x20 && f3 == 5) set_x(rd, int32_t(a) >> (b & 31));
+      else return TRAP_FAULT;
+      break;
+    }
+
+    case 0x0F:
+      break;
+
+    case 0x73: {
+      if (i == 0x00100073) return TRAP_EBREAK;
+      if (f3 == 0 || f3 == 4) return TRAP_FAULT;
+
+      uint32_t csr = i >> 20;
+      uint32_t src = (f3 & 4) ? rs1 : x(rs1);
+      int op = f3 & 3;
+      bool write = (op == 1) || rs1 != 0;
+      uint32_t old;
+      if (!csr_op(csr, op, src, write, old)) return TRAP_FAULT;
+      set_x(rd, old);
+      break;
+    }
+
+    default:
+      return TRAP_FAULT;
+  }
+
+  pc = next;
+  return TRAP_NONE;
+}
+
+//------------------------------------------------------------------------------
+
+SimTarget::Trap SimTarget::exec16(uint32_t c) {
+  uint32_t op = c & 3;
+  uint32_t f3 = (c >> 13) & 7;
+
+  uint32_t rd   = (c >> 7) & 31;  // also rs1
+  uint32_t rs2  = (c >> 2) & 31;
+  uint32_t rd_  = 8 + ((c >> 2) & 7);
+  uint32_t rs1_ = 8 + ((c >> 7) & 7);
+
+  auto set_x = [&](uint32_t r, uint32_t v) { if (r) gpr[r] = v; };
+
+  int32_t imm6  = sext(((c >> 7) & 0x20) | ((c >> 2) & 0x1F), 6);
+  int32_t imm_j = sext(((c >> 1) & 0x800) | ((c >> 7) & 0x10) | ((c >> 1) & 0x300) |
+                       ((c << 2) & 0x400) | ((c >> 1) & 0x40) | ((c << 1) & 0x80) |
+                       ((c >> 2) & 0xE) | ((c << 3) & 0x20), 12);
+  int32_t imm_b = sext(((c >> 4) & 0x100) | ((c >> 7) & 0x18) | ((c << 1) & 0xC0) |
+                       ((c >> 2) & 0x6) | ((c << 3) & 0x20), 9);
+  uint32_t uimm_lw = ((c >> 7) & 0x38) | ((c >> 4) & 0x4) | ((c << 1) & 0x40);
+
+  uint32_t next = pc + 2;
+
+  if (op == 0) {
+    switch (f3) {
+      case 0: {
+        uint32_t uimm = ((c >> 7) & 0x30) | ((c >> 1) & 0x3C0) | ((c >> 4) & 0x4) | ((c >> 2) & 0x8);
+        if (!uimm) return TRAP_FAULT;
+        set_x(rd_, gpr[2] + uimm);
+        break;
+      }
+      case 2: {
+        uint32_t v;
+        if (!load(gpr[rs1_] + uimm_lw, 4, v)) return TRAP_FAULT;
+        set_x(rd_, v);
+        break;
+      }
+      case 6:
+        if (!store(gpr[rs1_] + uimm_lw, 4, gpr[rd_])) return TRAP_FAULT;
+        break;
+      default:
+        return TRAP_FAULT;
+    }
+  }
+  else if (op == 1) {
+    switch (f3) {
+      case 0:
+        if (rd > 15) return TRAP_FAULT;
+        set_x(rd, gpr[rd] + imm6);
+        break;
+      case 1:
+        set_x(1, next);
+        next = pc + imm_j;
+        break;
+      case 2:
+        if (rd > 15) return TRAP_FAULT;
+        set_x(rd, imm6);
+        break;
+      case 3:
+        if (rd > 15) return TRAP_FAULT;
+        if (rd == 2) {
+          int32_t imm = sext(((c >> 3) & 0x200) | ((c >> 2) & 0x10) | ((c << 1) & 0x40) |
+                             ((c << 4) & 0x180) | ((c << 3) & 0x20), 10);
+          if (!imm) return TRAP_FAULT;
+          set_x(2, gpr[2] + imm);
+        }
+        else {
+          if (!imm6) return TRAP_FAULT;
+          set_x(rd, uint32_t(imm6) << 12);
+        }
+        break;
+      case 4: {
+        uint32_t f2 = (c >> 10) & 3;
+        uint32_t shamt = (c >> 2) & 0x1F;
+        uint32_t& r = gpr[rs1_];
+        switch (f2) {
+          case 0: if (c & 0x1000) return TRAP_FAULT; r = r >> shamt; break;
+          case 1: if (c & 0x1000) return TRAP_FAULT; r = int32_t(r) >> shamt; break;
+          case 2: r = r & imm6; break;
+          case 3:
+            if (c & 0x1000) return TRAP_FAULT;
+            switch ((c >> 5) & 3) {
+              case 0: r = r - gpr[rd_]; break;
+              case 1: r = r ^ gpr[rd_]; break;
+              case 2: r = r | gpr[rd_]; break;
+              case 3: r = r & gpr[rd_]; break;
+            }
+            break;
+        }
+        break;
+      }
+      case 5:
+        next = pc + imm_j;
+        break;
+      case 6:
+        if (gpr[rs1_] == 0) next = pc + imm_b;
+        break;
+      case 7:
+        if (gpr[rs1_] != 0) next = pc + imm_b;
+        break;
+    }
+  }
+  else {
+    // For c.slli the rs2 field is the shift amount.
+    if (rd > 15 || (f3 != 0 && rs2 > 15)) return TRAP_FAULT;
+    switch (f3) {
+      case 0:
+        if (c & 0x1000) return TRAP_FAULT;
+        set_x(rd, gpr[rd] << rs2);
+        break;
+      case 2: {
+        if (!rd) return TRAP_FAULT;
+        uint32_t uimm = ((c >> 7) & 0x20) | ((c >> 2) & 0x1C) | ((c << 4) & 0xC0);
+        uint32_t v;
+        if (!load(gpr[2] + uimm, 4, v)) return TRAP_FAULT;
+        set_x(rd, v);
+        break;
+      }
+      case 4:
+        if (!(c & 0x1000)) {
+          if (rs2 == 0) {
+            if (!rd) return TRAP_FAULT;
+            next = gpr[rd] & ~1;
+          }
+          else {
+            set_x(rd, gpr[rs2]);
+          }
+        }
+        else {
+          if (rd == 0 && rs2 == 0) return TRAP_EBREAK;
+          if (rs2 == 0) {
+            uint32_t target = gpr[rd] & ~1;
+            set_x(1, next);
+            next = target;
+          }
+          else {
+            set_x(rd, gpr[rd] + gpr[rs2]);
+          }
+        }
+        break;
+      case 6: {
+        uint32_t uimm = ((c >> 7) & 0x3C) | ((c >> 1) & 0xC0);
+        if (!store(gpr[2] + uimm, 4, gpr[rs2])) return TRAP_FAULT;
+        break;
+      }
+      default:
+        return TRAP_FAULT;
+    }
+  }
+
+  pc = next;
+  return TRAP_NONE;
+}
+
+//------------------------------------------------------------------------------
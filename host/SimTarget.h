@@ -0,0 +1,131 @@
+// Host-side stand-in for a CH32V003 on the end of the SWIO wire. Implements
+// Bus, so RVDebug/WCHFlash/SoftBreak/GDBServer can run unmodified on a PC.
+
+// Models the debug module registers, an RV32EC hart that executes the program
+// buffer (and flash, once resumed) against simulated flash and RAM, and the
+// flash controller's page-buffer programming path. Every DMI op is counted in
+// 'stats' and the time it would have taken on the wire in standard mode is
+// added to 'wire_ns'.
+
+#pragma once
+#include <map>
+#include <stdint.h>
+#include "Bus.h"
+#include "DMIStats.h"
+
+//------------------------------------------------------------------------------
+
+struct SimTarget : public Bus {
+  SimTarget();
+
+  // Power-on reset. Flash contents survive, everything else is cleared.
+  void power_on();
+
+  uint32_t get(uint32_t addr) override;
+  void     put(uint32_t addr, uint32_t data) override;
+
+  // Clears the DMI counters, wire time and instruction count.
+  void reset_counters();
+
+  // Estimated SWIO time for one frame in standard mode, in nanoseconds.
+  static uint32_t frame_ns(uint32_t addr, bool write, uint32_t data);
+
+  DMIStats stats;
+  uint64_t wire_ns = 0;
+  uint64_t insn_count = 0;
+
+  // Instructions the hart runs per DMI op while it's not halted.
+  int run_per_op = 64;
+
+  // Debug module shape, defaults are the CH32V003's. Other QingKe parts have
+  // fewer or more progbuf words, one data register, or don't map the data
+  // registers into the hart's address space.
+  int  progbuf_size = 8;
+  int  data_count = 2;
+  bool data_mapped = true;
+
+  static const uint32_t flash_base = 0x08000000;
+  static const uint32_t flash_size = 16 * 1024;
+  static const uint32_t ram_base   = 0x20000000;
+  static const uint32_t ram_size   = 2 * 1024;
+
+  uint8_t  flash[flash_size];
+  uint8_t  ram[ram_size];
+  uint32_t gpr[16];
+  uint32_t pc = 0;
+
+  bool halted = false;
+  bool hung = false;   // Hart took an exception outside debug mode
+
+private:
+
+  enum Trap { TRAP_NONE, TRAP_EBREAK, TRAP_FAULT };
+
+  //----------
+  // Debug module
+
+  void reset_dm();
+  void reset_hart();
+  void enter_debug(int cause);
+  void resume_hart();
+  void run_hart(int count);
+  void exec_command();
+  void run_progbuf();
+
+  bool get_reg(uint32_t regno, uint32_t& value);
+  bool set_reg(uint32_t regno, uint32_t value);
+
+  //----------
+  // Hart
+
+  Trap step_hart();
+  Trap exec32(uint32_t insn);
+  Trap exec16(uint32_t insn);
+  bool csr_op(uint32_t csr, int op, uint32_t src, bool write, uint32_t& old);
+
+  bool fetch16(uint32_t addr, uint32_t& out);
+  bool load(uint32_t addr, int size, uint32_t& out);
+  bool store(uint32_t addr, int size, uint32_t data);
+
+  //----------
+  // Flash controller
+
+  uint32_t get_flash_reg(uint32_t offset);
+  void     set_flash_reg(uint32_t offset, uint32_t data);
+
+  // DM state
+  uint32_t data0 = 0;
+  uint32_t data1 = 0;
+  uint32_t progbuf[16];
+  uint32_t dmcontrol = 0;
+  uint32_t command = 0;
+  uint32_t abstractauto = 0;
+  uint32_t cmderr = 0;
+  uint32_t cfgr = 0;
+  uint32_t shdwcfgr = 0;
+  bool resumeack = false;
+  bool havereset = false;
+
+  // Where the program buffer appears in the hart's address space, so that
+  // DATA0/DATA1 land at 0xE00000F4/0xE00000F8.
+  static const uint32_t progbuf_base = 0xE00000D4;
+  static const uint32_t data_base    = 0xE00000F4;
+
+  // Debug CSRs, other CSRs just hold whatever was written to them
+  uint32_t dcsr = 0;
+  uint32_t dpc = 0;
+  uint32_t dscratch0 = 0;
+  uint32_t dscratch1 = 0;
+  std::map<uint32_t, uint32_t> csrs;
+
+  // Flash controller state
+  uint32_t flash_ctlr = 0;
+  uint32_t flash_statr = 0;
+  uint32_t flash_addr = 0;
+  uint32_t flash_actlr = 0;
+  int      keyr_stage = 0;
+  int      mkeyr_stage = 0;
+  uint8_t  page_buf[64];
+};
+
+//------------------------------------------------------------------------------
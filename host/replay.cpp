@@ -0,0 +1,127 @@
+// Replays a DMI trace captured with TracingBus ("trace_dump" on the console)
+// against the simulated target and reports per-phase op counts, estimated
+// wire time and the time the phase actually took when it was recorded.
+//
+//   picorvd_replay capture.log
+//
+// Lines that aren't trace records are ignored, so a raw serial log works.
+
+#include "SimTarget.h"
+#include "TracingBus.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+struct Phase {
+  std::string tag;
+  int      count = 0;
+  uint64_t frames = 0;
+  uint64_t gets = 0;
+  uint64_t puts = 0;
+  uint64_t wire_ns = 0;
+  uint64_t real_us = 0;
+};
+
+static std::string tag_name(uint32_t packed) {
+  std::string s;
+  for (int i = 0; i < 4 && (packed >> (8 * i)) & 0xFF; i++) s += char(packed >> (8 * i));
+  return s.empty() ? "-" : s;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  FILE* f = stdin;
+  if (argc > 1) {
+    f = fopen(argv[1], "r");
+    if (!f) {
+      printf("Could not open %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  std::vector<TraceRecord> trace;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    TraceRecord r;
+    if (TracingBus::parse(line, r)) trace.push_back(r);
+  }
+  if (f != stdin) fclose(f);
+
+  if (trace.empty()) {
+    printf("No trace records found\n");
+    return 1;
+  }
+
+  // Ops before the first mark go into phase "-".
+  SimTarget sim;
+  std::vector<Phase> phases;
+  int current = -1;
+  uint32_t phase_start = trace[0].time;
+
+  auto enter = [&](const std::string& tag, uint32_t time) {
+    if (current >= 0) phases[current].real_us += time - phase_start;
+    phase_start = time;
+    current = -1;
+    for (int i = 0; i < (int)phases.size(); i++) {
+      if (phases[i].tag == tag) current = i;
+    }
+    if (current < 0) {
+      phases.push_back(Phase());
+      current = phases.size() - 1;
+      phases[current].tag = tag;
+    }
+    phases[current].count++;
+  };
+
+  enter("-", trace[0].time);
+  phases[current].count = 0;
+
+  uint32_t buf[0x10000];
+  for (auto& r : trace) {
+    if (r.op == TraceRecord::MARK) {
+      enter(tag_name(r.data), r.time);
+      continue;
+    }
+
+    uint32_t frames = sim.stats.frames;
+    uint64_t wire_ns = sim.wire_ns;
+
+    switch (r.op) {
+      case TraceRecord::GET:    sim.get(r.addr); break;
+      case TraceRecord::PUT:    sim.put(r.addr, r.data); break;
+      case TraceRecord::REPEAT: sim.get_repeat(r.addr, buf, r.count); break;
+      case TraceRecord::POLL:   for (int i = 0; i < r.count; i++) sim.get(r.addr); break;
+    }
+
+    auto& p = phases[current];
+    p.frames += sim.stats.frames - frames;
+    p.wire_ns += sim.wire_ns - wire_ns;
+    if (r.op == TraceRecord::PUT) p.puts++;
+    else p.gets += r.count;
+  }
+  phases[current].real_us += trace.back().time - phase_start;
+
+  printf("%-8s %8s %8s %8s %8s %10s %10s\n", "phase", "count", "frames", "gets", "puts", "wire ms", "real ms");
+  Phase total;
+  for (auto& p : phases) {
+    if (!p.count && !p.frames) continue;
+    printf("%-8s %8d %8llu %8llu %8llu %10.2f %10.2f\n", p.tag.c_str(), p.count,
+           (unsigned long long)p.frames, (unsigned long long)p.gets, (unsigned long long)p.puts,
+           p.wire_ns / 1.0e6, p.real_us / 1.0e3);
+    total.frames += p.frames;
+    total.gets += p.gets;
+    total.puts += p.puts;
+    total.wire_ns += p.wire_ns;
+    total.real_us += p.real_us;
+  }
+  printf("%-8s %8s %8llu %8llu %8llu %10.2f %10.2f\n", "total", "",
+         (unsigned long long)total.frames, (unsigned long long)total.gets, (unsigned long long)total.puts,
+         total.wire_ns / 1.0e6, total.real_us / 1.0e3);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
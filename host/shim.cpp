@@ -0,0 +1,19 @@
+#include "hardware/timer.h"
+
+#include <chrono>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+uint32_t time_us_32() {
+  using namespace std::chrono;
+  static const auto start = steady_clock::now();
+  return uint32_t(duration_cast<microseconds>(steady_clock::now() - start).count());
+}
+
+// WCHFlash expects this from main.cpp.
+void delay_us(int us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,6 @@
+// Host build stand-in for the Pico SDK timer - microseconds since startup.
+
+#pragma once
+#include <stdint.h>
+
+uint32_t time_us_32();
@@ -0,0 +1,5 @@
+// Host build stand-in for the Pico SDK header. The shared modules only need
+// the timer functions from it.
+
+#pragma once
+#include "hardware/timer.h"
@@ -0,0 +1,173 @@
+// DMI traffic benchmark - runs typical debugger workloads against the
+// simulated target and reports per-phase frame counts and estimated wire time.
+//
+// With "--trace" the GDB part of the run is also recorded with TracingBus and
+// dumped at the end, in the same format as the console's "trace_dump".
+
+#include "SimTarget.h"
+#include "RVDebug.h"
+#include "WCHFlash.h"
+#include "SoftBreak.h"
+#include "GDBServer.h"
+#include "TracingBus.h"
+#include "CachingBus.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+//------------------------------------------------------------------------------
+// Feeds one packet to the GDB stub a byte at a time, acks the reply and
+// returns it.
+
+static std::string gdb_command(GDBServer& gdb, const char* payload) {
+  uint8_t checksum = 0;
+  for (const char* c = payload; *c; c++) checksum += *c;
+
+  char packet[1024];
+  snprintf(packet, sizeof(packet), "$%s#%02x", payload, checksum);
+
+  bool oe;
+  char out;
+  for (const char* c = packet; *c; c++) gdb.update(true, true, *c, oe, out);
+
+  std::string reply;
+  for (int i = 0; i < 1000000; i++) {
+    gdb.update(true, false, 0, oe, out);
+    if (oe) reply += out;
+    if (reply.size() >= 3 && reply[reply.size() - 3] == '#') break;
+  }
+  gdb.update(true, true, '+', oe, out);
+  return reply;
+}
+
+//------------------------------------------------------------------------------
+
+struct Bench {
+  SimTarget& sim;
+  uint64_t total_frames = 0;
+  uint64_t total_ns = 0;
+
+  template<typename F>
+  void phase(const char* name, F f) {
+    sim.reset_counters();
+    f();
+
+    uint32_t gets = 0, puts = 0;
+    for (int i = 0; i < 128; i++) {
+      gets += sim.stats.gets[i];
+      puts += sim.stats.puts[i];
+    }
+    printf("%-24s %8u %8u %8u %8u %10.2f %10llu\n", name, sim.stats.frames, gets, puts,
+           sim.stats.prog_words, sim.wire_ns / 1.0e6, (unsigned long long)sim.insn_count);
+
+    total_frames += sim.stats.frames;
+    total_ns += sim.wire_ns;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  bool tracing = argc > 1 && strcmp(argv[1], "--trace") == 0;
+
+  SimTarget sim;
+  TracingBus trace(&sim);
+  CachingBus cache(&trace);
+  RVDebug rvd(&cache, 16);
+  rvd.stats = &sim.stats;
+  rvd.init();
+  WCHFlash flash(&rvd, SimTarget::flash_size);
+  flash.reset();
+  SoftBreak soft(&rvd, &flash);
+  soft.init();
+  GDBServer gdb(&rvd, &flash, &soft, &sim.stats);
+  gdb.reset();
+  gdb.trace = &trace;
+
+  // 4K of flash image that starts with a two-instruction loop to step through
+  static uint8_t image[4096];
+  for (int i = 0; i < 4096; i++) image[i] = i * 13 + 7;
+  const uint32_t loop[2] = {
+    0x00150513, // addi a0, a0, 1
+    0xffdff06f, // j    0
+  };
+  memcpy(image, loop, sizeof(loop));
+
+  static uint8_t ram_buf[2048];
+  for (int i = 0; i < 2048; i++) ram_buf[i] = i ^ 0x5A;
+
+  printf("%-24s %8s %8s %8s %8s %10s %10s\n", "phase", "frames", "gets", "puts", "progbuf", "wire ms",
+         "insns");
+
+  Bench b = { sim };
+
+  b.phase("reset", [&]() { rvd.reset(); });
+  b.phase("wipe chip", [&]() { flash.wipe_chip(); });
+  b.phase("write flash 4K", [&]() { flash.write_flash(0x08000000, image, sizeof(image)); });
+  b.phase("verify flash 4K", [&]() { flash.verify_flash(0x08000000, image, sizeof(image)); });
+  b.phase("write ram 2K", [&]() { rvd.set_block_aligned(0x20000000, ram_buf, sizeof(ram_buf)); });
+  b.phase("read ram 2K", [&]() { rvd.get_block_aligned(0x20000000, ram_buf, sizeof(ram_buf)); });
+  b.phase("fill ram 2K", [&]() { rvd.fill_mem(0x20000000, 0, 2048); });
+  b.phase("copy ram 1K", [&]() { rvd.copy_mem(0x20000400, 0x20000000, 1024); });
+  b.phase("read ram u32 x64", [&]() {
+    for (int i = 0; i < 64; i++) rvd.get_mem_u32(0x20000000 + i * 4);
+  });
+  b.phase("poll u32 x64", [&]() {
+    for (int i = 0; i < 64; i++) rvd.get_mem_u32(0x4002200C);
+  });
+  b.phase("read gprs x10", [&]() {
+    for (int j = 0; j < 10; j++) {
+      for (int i = 0; i < 16; i++) rvd.get_gpr(i);
+      rvd.get_dpc();
+    }
+  });
+  b.phase("reset + step x100", [&]() {
+    rvd.reset();
+    for (int i = 0; i < 100; i++) rvd.step();
+  });
+  b.phase("step_n 100", [&]() { rvd.step_n(100); });
+  b.phase("write flash 64B + step", [&]() {
+    flash.write_flash(0x08000000, image, 64);
+    rvd.step();
+  });
+
+  if (tracing) trace.start();
+
+  b.phase("gdb connect", [&]() {
+    bool oe;
+    char out;
+    gdb.update(true, false, 0, oe, out);
+  });
+  b.phase("gdb g x10", [&]() {
+    for (int i = 0; i < 10; i++) gdb_command(gdb, "g");
+  });
+  b.phase("gdb m 256B x10", [&]() {
+    for (int i = 0; i < 10; i++) gdb_command(gdb, "m20000000,100");
+  });
+  b.phase("gdb m unaligned x10", [&]() {
+    for (int i = 0; i < 10; i++) gdb_command(gdb, "m20000101,3f");
+  });
+  b.phase("gdb M 64B x10", [&]() {
+    char cmd[200] = "M20000100,40:";
+    for (int i = 0; i < 64; i++) snprintf(cmd + 13 + i * 2, 3, "%02x", i);
+    for (int i = 0; i < 10; i++) gdb_command(gdb, cmd);
+  });
+  b.phase("gdb M unaligned x10", [&]() {
+    for (int i = 0; i < 10; i++) gdb_command(gdb, "M20000101,7:01020304050607");
+  });
+  b.phase("gdb qCRC 16K", [&]() { gdb_command(gdb, "qCRC:8000000,4000"); });
+  b.phase("gdb qSearch 4K", [&]() { gdb_command(gdb, "qSearch:memory:8000000;1000;\xff\xfe\xfd\xfc\xfb"); });
+  b.phase("gdb s x10", [&]() {
+    for (int i = 0; i < 10; i++) gdb_command(gdb, "s");
+  });
+
+  printf("%-24s %8llu %8s %8s %8s %10.2f\n", "total", (unsigned long long)b.total_frames, "", "", "",
+         b.total_ns / 1.0e6);
+
+  if (tracing) trace.dump();
+  return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,388 @@
+// Runs the on-device test suite, plus a few flash and stepping checks, against
+// the simulated target. Built with PICORVD_CHECKS so any CHECK() failure
+// aborts the run.
+
+#include "SimTarget.h"
+#include "RVDebug.h"
+#include "WCHFlash.h"
+#include "TracingBus.h"
+#include "CachingBus.h"
+#include "picorvd_tests.h"
+#include "utils.h"
+#include "debug_defines.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+static void test_flash(SimTarget& sim, RVDebug& rvd, WCHFlash& flash) {
+  printf("Running flash tests...\n");
+
+  uint8_t blob[256];
+  for (int i = 0; i < 256; i++) blob[i] = i * 7 + 3;
+
+  flash.wipe_chip();
+  for (int i = 0; i < 1024; i++) CHECK(sim.flash[i] == 0xFF);
+
+  // Starts on the second page and spans four pages
+  flash.write_flash(0x08000040, blob, sizeof(blob));
+  CHECK(memcmp(sim.flash + 0x40, blob, sizeof(blob)) == 0);
+  CHECK(flash.verify_flash(0x08000040, blob, sizeof(blob)));
+  CHECK(rvd.crc32(0x08000040, sizeof(blob)) == update_crc32(0xFFFFFFFF, blob, sizeof(blob)));
+  blob[100]++;
+  CHECK(!flash.verify_flash(0x08000040, blob, sizeof(blob)));
+  blob[100]--;
+  CHECK(rvd.get_mem_u32(0x08000040) == 0x18110A03);
+
+  flash.wipe_page(0x08000080);
+  for (int i = 0; i < 64; i++) CHECK(sim.flash[0x80 + i] == 0xFF);
+  CHECK(sim.flash[0x7F] == blob[0x3F]);
+  CHECK(sim.flash[0xC0] == blob[0x80]);
+
+  flash.wipe_sector(0x08000000);
+  for (int i = 0; i < 1024; i++) CHECK(sim.flash[i] == 0xFF);
+
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+  printf("Flash tests pass!\n");
+}
+
+//------------------------------------------------------------------------------
+
+static void test_step(SimTarget& sim, RVDebug& rvd, WCHFlash& flash) {
+  printf("Running step tests...\n");
+
+  uint32_t prog[3] = {
+    0x00150513, // addi a0, a0, 1
+    0xffdff06f, // j    0
+    0x00100073, // ebreak
+  };
+  flash.wipe_chip();
+  flash.write_flash(0x00000000, prog, sizeof(prog));
+  rvd.reset();
+
+  CHECK(rvd.get_dpc() == 0);
+  rvd.set_gpr(10, 0);
+  for (int i = 0; i < 10; i++) rvd.step();
+  CHECK(rvd.get_gpr(10) == 5);
+  CHECK(rvd.get_dpc() == 0);
+
+  // Run freely for a while, then halt.
+  rvd.resume();
+  for (int i = 0; i < 10; i++) rvd.get_dmstatus();
+  CHECK(!sim.halted);
+  rvd.halt();
+  CHECK(rvd.get_gpr(10) > 5);
+
+  // Jumping to the ebreak halts again with EBREAKM set.
+  rvd.set_dpc(8);
+  rvd.resume();
+  CHECK(rvd.get_dmstatus().ALLHALTED);
+  CHECK(rvd.get_dpc() == 8);
+
+  // Registers are fetched once per stop and writes wait for the next resume.
+  rvd.halt();
+  uint32_t frames = sim.stats.frames;
+  for (int i = 0; i < 16; i++) rvd.get_gpr(i);
+  rvd.get_dpc();
+  uint32_t fetch_frames = sim.stats.frames - frames;
+  for (int i = 0; i < 16; i++) rvd.get_gpr(i);
+  rvd.get_dpc();
+  rvd.set_gpr(10, 100);
+  rvd.set_dpc(0);
+  CHECK(sim.stats.frames - frames == fetch_frames);
+  CHECK(sim.gpr[10] != 100);
+  rvd.step();
+  CHECK(sim.gpr[10] == 101);
+  CHECK(rvd.get_gpr(10) == 101);
+
+  // get_gprs() reads the registers in place, so resume has nothing to put back,
+  // and it doesn't fetch x0.
+  rvd.halt();
+  for (int i = 1; i < 16; i++) {
+    if (i != 10) sim.gpr[i] = 0x1000 * i + 7;
+  }
+  uint32_t saved[16];
+  memcpy(saved, sim.gpr, sizeof(saved));
+  uint32_t regs[17];
+  frames = sim.stats.frames;
+  rvd.get_gprs(regs);
+  CHECK(sim.stats.frames - frames == fetch_frames - 2);
+  for (int i = 1; i < 16; i++) CHECK(regs[i] == saved[i]);
+  CHECK(regs[0] == 0 && regs[16] == 4);
+  CHECK(memcmp(sim.gpr, saved, sizeof(saved)) == 0);
+  rvd.set_dpc(0);
+  rvd.step();
+  saved[10]++;
+  CHECK(memcmp(sim.gpr, saved, sizeof(saved)) == 0);
+
+  // And the same for a full register write.
+  for (int i = 1; i < 16; i++) regs[i] = 0xA5000000 | i;
+  regs[16] = 0;
+  rvd.set_gprs(regs);
+  rvd.step();
+  for (int i = 1; i < 16; i++) CHECK(sim.gpr[i] == (i == 10 ? 0xA500000B : 0xA5000000 | i));
+
+  // A scattered set of dirty registers goes back in one stream too, and the
+  // second time around the program is already loaded.
+  uint32_t scattered = 0xADB6;
+  uint32_t step_frames[2];
+  rvd.set_dpc(0);
+  frames = sim.stats.frames;
+  rvd.step();
+  uint32_t dpc_only_frames = sim.stats.frames - frames;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 1; i < 16; i++) {
+      if (bit(scattered, i)) rvd.set_gpr(i, 0x5A000000 | (pass << 8) | i);
+    }
+    rvd.set_dpc(0);
+    frames = sim.stats.frames;
+    rvd.step();
+    step_frames[pass] = sim.stats.frames - frames;
+    for (int i = 1; i < 16; i++) {
+      uint32_t expected = bit(scattered, i) ? 0x5A000000 | (pass << 8) | i : 0xA5000000 | i;
+      CHECK(sim.gpr[i] == expected + (i == 10));
+    }
+  }
+  CHECK(step_frames[1] < step_frames[0]);
+  CHECK(step_frames[1] - dpc_only_frames < 2 * 10);
+
+  // step_n() only resumes (two DMCONTROL writes) and polls per instruction,
+  // and resume() drops STEP.
+  rvd.set_gpr(10, 0);
+  rvd.set_dpc(0);
+  rvd.step();
+  frames = sim.stats.frames;
+  rvd.step_n(9);
+  CHECK(sim.stats.frames - frames <= 1 + 3 * 9);
+  CHECK(rvd.get_gpr(10) == 5);
+  CHECK(rvd.get_dcsr().STEP == 1);
+  rvd.resume();
+  for (int i = 0; i < 10; i++) rvd.get_dmstatus();
+  CHECK(!sim.halted);
+  rvd.halt();
+  CHECK(rvd.get_dcsr().STEP == 0);
+
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+  printf("Step tests pass!\n");
+}
+
+//------------------------------------------------------------------------------
+
+static void test_hot_addrs(SimTarget& sim, RVDebug& rvd) {
+  printf("Running hot address tests...\n");
+
+  // Cold addresses go through DATA1...
+  rvd.get_mem_u32(0x20000400);
+  uint32_t frames = sim.stats.frames;
+  rvd.get_mem_u32(0x20000410);
+  uint32_t cold_frames = sim.stats.frames - frames;
+
+  // ...hot ones get their own program and skip it.
+  for (int i = 0; i < 16; i++) {
+    rvd.set_mem_u32(0x20000404, 0x1234 + i);
+    CHECK(rvd.get_mem_u32(0x20000404) == 0x1234u + i);
+  }
+  frames = sim.stats.frames;
+  rvd.get_mem_u32(0x20000404);
+  CHECK(sim.stats.frames - frames == cold_frames - 1);
+
+  // Neighbours and other hot addresses are unaffected.
+  rvd.set_mem_u32(0x20000408, 0xCAFEF00D);
+  CHECK(rvd.get_mem_u32(0x20000404) == 0x1243);
+  CHECK(rvd.get_mem_u32(0x20000408) == 0xCAFEF00D);
+  CHECK(sim.ram[0x404] == 0x43 && sim.ram[0x408] == 0x0D);
+
+  // Reloading the resident program uploads nothing, and flipping between the
+  // read and write programs for one address only changes their middle words.
+  rvd.get_mem_u32(0x20000404);
+  uint32_t loads = sim.stats.prog_loads;
+  uint32_t resident = sim.stats.prog_resident;
+  uint32_t words = sim.stats.prog_words;
+  rvd.get_mem_u32(0x20000404);
+  for (int i = 0; i < 4; i++) {
+    rvd.set_mem_u32(0x20000404, i);
+    CHECK(rvd.get_mem_u32(0x20000404) == uint32_t(i));
+  }
+  CHECK(sim.stats.prog_loads - loads == 9);
+  CHECK(sim.stats.prog_resident - resident == 1);
+  CHECK(sim.stats.prog_words - words == 2 * 8);
+
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+  printf("Hot address tests pass!\n");
+}
+
+//------------------------------------------------------------------------------
+// A debug module with two progbuf words, only DATA0, and no memory-mapped
+// data registers gets the one-word programs and the same results. One with
+// sixteen words runs the CH32V003 programs, which mustn't fall through into
+// the words past PROGBUF7.
+
+static void test_dm_shape(int progbuf_size, int data_count, bool data_mapped) {
+  printf("Running %d-word debug module tests...\n", progbuf_size);
+
+  SimTarget sim;
+  sim.progbuf_size = progbuf_size;
+  sim.data_count = data_count;
+  sim.data_mapped = data_mapped;
+
+  RVDebug rvd(&sim, 16);
+  CHECK(rvd.get_progbuf_size() == progbuf_size);
+  CHECK(rvd.get_data_count() == data_count);
+  CHECK(rvd.get_data_addr() == (data_mapped ? 0xE00000F4 : 0));
+
+  WCHFlash flash(&rvd, SimTarget::flash_size);
+  rvd.reset();
+  run_tests(rvd);
+
+  uint8_t blob[128];
+  for (int i = 0; i < 128; i++) blob[i] = i * 5 + 1;
+  const uint32_t loop = 0x0000006f; // j 0
+  memcpy(blob, &loop, 4);
+  flash.wipe_chip();
+  flash.write_flash(0x08000000, blob, sizeof(blob));
+  CHECK(memcmp(sim.flash, blob, sizeof(blob)) == 0);
+  CHECK(flash.verify_flash(0x08000000, blob, sizeof(blob)));
+
+  uint32_t regs[17];
+  for (int i = 1; i < 16; i++) regs[i] = 0x5A000000 | i;
+  regs[16] = 0;
+  rvd.set_gprs(regs);
+  rvd.set_mem_u32(0x20000000, 0x12345678);
+  CHECK(rvd.get_mem_u32(0x20000000) == 0x12345678);
+  rvd.step();
+  CHECK(sim.halted && rvd.get_dpc() == 0);
+  for (int i = 1; i < 16; i++) CHECK(sim.gpr[i] == (0x5A000000u | i));
+
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+  printf("%d-word debug module tests pass!\n", progbuf_size);
+}
+
+//------------------------------------------------------------------------------
+
+static void test_trace(SimTarget& sim) {
+  printf("Running trace tests...\n");
+
+  TracingBus trace(&sim);
+  RVDebug rvd(&trace, 16);
+
+  trace.start();
+  trace.mark("m20000000,40");
+  uint32_t frames = sim.stats.frames;
+  uint32_t buf[16];
+  rvd.get_block_aligned(0x20000000, buf, sizeof(buf));
+  frames = sim.stats.frames - frames;
+  trace.stop();
+
+  // Every frame is in the trace, the repeated DATA0 reads as one record.
+  uint32_t traced = 0;
+  for (int i = 1; i < trace.size(); i++) traced += trace.at(i).count;
+  CHECK(traced == frames);
+  CHECK(trace.size() < int(frames));
+  CHECK(trace.at(0).op == TraceRecord::MARK);
+  CHECK(trace.at(0).data == 'm');
+
+  // A poll records how many reads it took.
+  trace.clear();
+  trace.start();
+  frames = sim.stats.frames;
+  trace.poll(DM_DMSTATUS, 0x80000000, 0x80000000, 5, nullptr);
+  trace.stop();
+  CHECK(trace.size() == 1 && trace.at(0).op == TraceRecord::POLL);
+  CHECK(trace.at(0).count == 5 && sim.stats.frames - frames == 5);
+
+  TraceRecord r;
+  CHECK(TracingBus::parse("TR 00001234 deadbeef 02 04 000f\n", r));
+  CHECK(r.time == 0x1234 && r.data == 0xDEADBEEF && r.op == TraceRecord::REPEAT);
+  CHECK(r.addr == 0x04 && r.count == 15);
+  CHECK(!TracingBus::parse("trace end\n", r));
+
+  printf("Trace tests pass!\n");
+}
+
+//------------------------------------------------------------------------------
+
+static void test_cache(SimTarget& sim) {
+  printf("Running cache tests...\n");
+
+  CachingBus cache(&sim);
+  cache.invalidate();
+
+  // Repeated config writes and reads only hit the target once.
+  uint32_t frames = sim.stats.frames;
+  cache.put(DM_ABSTRACTAUTO, 0);
+  cache.put(DM_ABSTRACTAUTO, 0);
+  CHECK(cache.get(DM_ABSTRACTAUTO) == 0);
+  cache.put(DM_DMCONTROL, 0x00000001);
+  cache.put(DM_DMCONTROL, 0x00000001);
+  CHECK(cache.get(DM_DMCONTROL) == 0x00000001);
+  CHECK(sim.stats.frames - frames == 2);
+  CHECK(cache.writes_elided == 2 && cache.reads_served == 2);
+
+  // Volatile registers and W1 bits always go through.
+  frames = sim.stats.frames;
+  cache.get(DM_DMSTATUS);
+  cache.get(DM_DMSTATUS);
+  cache.put(DM_DMCONTROL, 0x10000001);
+  cache.put(DM_DMCONTROL, 0x10000001);
+  CHECK(sim.stats.frames - frames == 4);
+
+  // A W1 write leaves DMCONTROL unknown until the next level write, which
+  // always goes out even if a read in between matches it.
+  frames = sim.stats.frames;
+  CHECK(cache.get(DM_DMCONTROL) == 0x00000001);
+  cache.put(DM_DMCONTROL, 0x00000001);
+  CHECK(sim.stats.frames - frames == 2);
+  frames = sim.stats.frames;
+  CHECK(cache.get(DM_DMCONTROL) == 0x00000001);
+  cache.put(DM_DMCONTROL, 0x00000001);
+  CHECK(sim.stats.frames - frames == 0);
+
+  // Batches are filtered the same way and results land in order.
+  cache.put(DM_DMCONTROL, 0x00000001);
+  cache.put(DM_PROGBUF0, 0x00100073);
+  frames = sim.stats.frames;
+  DmiOp ops[] = {
+    { DM_PROGBUF0, 0x00100073, true },
+    { DM_PROGBUF0, 0, false },
+    { DM_ABSTRACTCS, 0, false },
+    { DM_DMCONTROL, 0, false },
+  };
+  uint32_t results[3];
+  cache.transact(ops, 4, results);
+  CHECK(results[0] == 0x00100073);
+  CHECK(results[1] == 0x08000002);
+  CHECK(results[2] == 0x00000001);
+  CHECK(sim.stats.frames - frames == 1);
+
+  printf("Cache tests pass!\n");
+}
+
+//------------------------------------------------------------------------------
+
+int main() {
+  SimTarget sim;
+  CachingBus cache(&sim);
+  RVDebug rvd(&cache, 16);
+  rvd.stats = &sim.stats;
+  rvd.init();
+
+  WCHFlash flash(&rvd, SimTarget::flash_size);
+  flash.reset();
+
+  rvd.reset();
+  CHECK(rvd.sanity());
+  run_tests(rvd);
+  test_flash(sim, rvd, flash);
+  test_step(sim, rvd, flash);
+  test_hot_addrs(sim, rvd);
+  test_dm_shape(2, 1, false);
+  test_dm_shape(16, 2, true);
+  test_trace(sim);
+  test_cache(sim);
+
+  printf("%llu instructions, %u frames\n", (unsigned long long)sim.insn_count, sim.stats.frames);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -1,10 +1,63 @@
 #pragma once
 #include <stdint.h>
 
+// One get or put on the debug module interface.
+struct DmiOp {
+  uint32_t addr;
+  uint32_t data;
+  bool     write;
+};
+
 struct Bus {
   virtual uint32_t get(uint32_t addr) = 0;
   virtual void     put(uint32_t addr, uint32_t data) = 0;
 
+  // Runs a sequence of gets and puts in order. The result of each get is
+  // stored in the next slot of 'results'. Implementations can override this
+  // to run the whole batch without stopping between ops.
+  virtual void transact(const DmiOp* ops, int count, uint32_t* results) {
+    for (int i = 0; i < count; i++) {
+      if (ops[i].write) {
+        put(ops[i].addr, ops[i].data);
+      }
+      else {
+        *results++ = get(ops[i].addr);
+      }
+    }
+  }
+
+  // Reads 'addr' until (value & mask) == expect or until max_iters reads have
+  // been done, and returns the last value read. Callers check the condition
+  // themselves to tell a match from a timeout. If 'reads' isn't null it gets
+  // the number of reads that went out. Implementations can override this to
+  // poll without the CPU in the loop.
+  virtual uint32_t poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) {
+    uint32_t value = 0;
+    int i = 0;
+    while (i < max_iters) {
+      value = get(addr);
+      i++;
+      if ((value & mask) == expect) break;
+    }
+    if (reads) *reads = i;
+    return value;
+  }
+
+  // Reads the same register 'count' times in a row, e.g. DATA0 with
+  // ABSTRACTAUTO set. Implementations can override this to send the reads as
+  // a single block.
+  virtual void get_repeat(uint32_t addr, uint32_t* data, int count) {
+    for (int i = 0; i < count; i++) data[i] = get(addr);
+  }
+
+  // Drops anything this bus (or a bus below it) remembers about the debug
+  // module's registers. Called when the target is reset.
+  virtual void invalidate() {}
+
+  // Runs fn(arg) after everything already sent, on whichever core owns the
+  // bottom of the bus stack, and returns once it's done.
+  virtual void call(void (*fn)(void*), void* arg) { fn(arg); }
+
   /*
   uint32_t get_mem_u32(uint32_t addr);
   uint16_t get_mem_u16(uint32_t addr);
@@ -22,3 +75,47 @@ struct Bus {
   void set_block_unaligned(uint32_t addr, void* data, int size);
   */
 };
+
+//------------------------------------------------------------------------------
+// Collects gets and puts and sends them to the bus in batches. Results of gets
+// are written to 'results' in order as each batch completes. Batches live on
+// the stack, so they stay small.
+
+struct DmiBatch {
+  DmiBatch(Bus* bus, uint32_t* results) : bus(bus), results(results) {}
+  ~DmiBatch() { flush(); }
+
+  void get(uint32_t addr) {
+    if (count == op_max) flush();
+    ops[count++] = { addr, 0, false };
+    reads++;
+  }
+
+  void put(uint32_t addr, uint32_t data) {
+    if (count == op_max) flush();
+    ops[count++] = { addr, data, true };
+  }
+
+  // Repeated reads go straight to the bus after anything already queued.
+  void get_repeat(uint32_t addr, int n) {
+    flush();
+    bus->get_repeat(addr, results, n);
+    results += n;
+  }
+
+  void flush() {
+    if (!count) return;
+    bus->transact(ops, count, results);
+    if (results) results += reads;
+    count = 0;
+    reads = 0;
+  }
+
+  static const int op_max = 16;
+
+  Bus*      bus;
+  uint32_t* results;
+  DmiOp     ops[op_max];
+  int       count = 0;
+  int       reads = 0;
+};
@@ -0,0 +1,165 @@
+#include "CachingBus.h"
+
+#include "debug_defines.h"
+
+// WCH-specific configuration registers, written with a 0x5AA5 key
+static const uint32_t WCH_DM_CFGR     = 0x7D;
+static const uint32_t WCH_DM_SHDWCFGR = 0x7E;
+
+// DMCONTROL bits that trigger something when written as 1 - RESUMEREQ,
+// ACKHAVERESET, ACKUNAVAIL and the keepalive/resethaltreq set/clear pairs.
+// Writing any of these is never skipped. The level write that usually follows
+// one (the "0x00000001" after a resume) is never skipped either - we don't
+// know whether the debug module needs it to drop the request - so a W1 write
+// leaves the DMCONTROL shadow unknown until the next level write goes out.
+static const uint32_t dmcontrol_w1_bits = 0x5800003C;
+
+//------------------------------------------------------------------------------
+
+CachingBus::Policy CachingBus::policy(uint32_t addr) {
+  if (addr >= DM_PROGBUF0 && addr <= DM_PROGBUF7) return CONFIG;
+  switch (addr) {
+    case DM_DMCONTROL:    return CONFIG;
+    case DM_ABSTRACTAUTO: return CONFIG;
+    case WCH_DM_CFGR:     return WRITE_ONLY;
+    case WCH_DM_SHDWCFGR: return WRITE_ONLY;
+  }
+  return VOLATILE;
+}
+
+bool CachingBus::can_elide(uint32_t addr, uint32_t data) const {
+  if (policy(addr) == VOLATILE) return false;
+  if (!((known[addr >> 5] >> (addr & 31)) & 1)) return false;
+  if (addr == DM_DMCONTROL && (data & dmcontrol_w1_bits)) return false;
+  return shadow[addr] == data;
+}
+
+bool CachingBus::can_serve(uint32_t addr) const {
+  if (policy(addr) != CONFIG) return false;
+  return (known[addr >> 5] >> (addr & 31)) & 1;
+}
+
+void CachingBus::on_write(uint32_t addr, uint32_t data) {
+  // Clearing DMACTIVE resets the whole debug module.
+  if (addr == DM_DMCONTROL && !(data & 1)) {
+    invalidate();
+    return;
+  }
+  if (policy(addr) == VOLATILE) return;
+  if (addr == DM_DMCONTROL) {
+    dmcontrol_w1_sent = data & dmcontrol_w1_bits;
+    if (dmcontrol_w1_sent) {
+      known[addr >> 5] &= ~(1 << (addr & 31));
+      return;
+    }
+  }
+  shadow[addr] = data;
+  known[addr >> 5] |= 1 << (addr & 31);
+}
+
+void CachingBus::on_read(uint32_t addr, uint32_t data) {
+  if (policy(addr) != CONFIG) return;
+  if (addr == DM_DMCONTROL && dmcontrol_w1_sent) return;
+  shadow[addr] = data;
+  known[addr >> 5] |= 1 << (addr & 31);
+}
+
+void CachingBus::invalidate() {
+  for (int i = 0; i < 4; i++) known[i] = 0;
+  dmcontrol_w1_sent = false;
+  target->invalidate();
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t CachingBus::get(uint32_t addr) {
+  if (can_serve(addr)) {
+    reads_served++;
+    return shadow[addr];
+  }
+  uint32_t data = target->get(addr);
+  on_read(addr, data);
+  return data;
+}
+
+void CachingBus::put(uint32_t addr, uint32_t data) {
+  if (can_elide(addr, data)) {
+    writes_elided++;
+    return;
+  }
+  target->put(addr, data);
+  on_write(addr, data);
+}
+
+//------------------------------------------------------------------------------
+// Filters the batch in chunks - elided writes are dropped, served reads are
+// filled in directly, and the results of the remaining reads are scattered
+// back into their slots once the chunk completes. Chunks are kept small as
+// this sits on core0's 2K stack under the GDB packet handlers.
+
+void CachingBus::transact(const DmiOp* ops, int count, uint32_t* results) {
+  static const int chunk_max = 8;
+  DmiOp     chunk[chunk_max];
+  uint32_t  chunk_results[chunk_max];
+  uint32_t* slots[chunk_max];
+  int chunk_count = 0;
+  int chunk_reads = 0;
+
+  auto flush = [&]() {
+    if (!chunk_count) return;
+    target->transact(chunk, chunk_count, chunk_results);
+    int r = 0;
+    for (int i = 0; i < chunk_count; i++) {
+      if (chunk[i].write) continue;
+      *slots[r] = chunk_results[r];
+      on_read(chunk[i].addr, chunk_results[r]);
+      r++;
+    }
+    chunk_count = 0;
+    chunk_reads = 0;
+  };
+
+  for (int i = 0; i < count; i++) {
+    auto& op = ops[i];
+    if (op.write) {
+      if (can_elide(op.addr, op.data)) {
+        writes_elided++;
+        continue;
+      }
+      on_write(op.addr, op.data);
+    }
+    else {
+      uint32_t* slot = results++;
+      if (can_serve(op.addr)) {
+        reads_served++;
+        *slot = shadow[op.addr];
+        continue;
+      }
+      slots[chunk_reads++] = slot;
+    }
+
+    chunk[chunk_count++] = op;
+    if (chunk_count == chunk_max) flush();
+  }
+  flush();
+}
+
+//------------------------------------------------------------------------------
+
+void CachingBus::get_repeat(uint32_t addr, uint32_t* data, int count) {
+  if (can_serve(addr)) {
+    reads_served += count;
+    for (int i = 0; i < count; i++) data[i] = shadow[addr];
+    return;
+  }
+  target->get_repeat(addr, data, count);
+  if (count) on_read(addr, data[count - 1]);
+}
+
+uint32_t CachingBus::poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) {
+  uint32_t data = target->poll(addr, mask, expect, max_iters, reads);
+  on_read(addr, data);
+  return data;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,50 @@
+// Bus decorator that keeps a shadow copy of the debug module's configuration
+// registers. Writes of a value the target already holds are dropped, and reads
+// of configuration registers are answered from the shadow copy once known.
+
+// DATA0/1, DMSTATUS, ABSTRACTCS, COMMAND and everything else that the target
+// changes by itself (or whose writes have side effects) always goes through.
+
+#pragma once
+#include <stdint.h>
+#include "Bus.h"
+
+//------------------------------------------------------------------------------
+
+struct CachingBus : public Bus {
+  CachingBus(Bus* target) : target(target) {}
+
+  uint32_t get(uint32_t addr) override;
+  void     put(uint32_t addr, uint32_t data) override;
+  void     transact(const DmiOp* ops, int count, uint32_t* results) override;
+  void     get_repeat(uint32_t addr, uint32_t* data, int count) override;
+  uint32_t poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) override;
+  void     invalidate() override;
+  void     call(void (*fn)(void*), void* arg) override { target->call(fn, arg); }
+
+  uint32_t writes_elided = 0;
+  uint32_t reads_served = 0;
+
+private:
+
+  enum Policy {
+    VOLATILE,   // Always goes to the target
+    CONFIG,     // Writes elided, reads served from the shadow
+    WRITE_ONLY, // Writes elided, reads go to the target (readback differs)
+  };
+
+  static Policy policy(uint32_t addr);
+
+  // True if writing 'data' to 'addr' can be skipped.
+  bool can_elide(uint32_t addr, uint32_t data) const;
+  bool can_serve(uint32_t addr) const;
+  void on_write(uint32_t addr, uint32_t data);
+  void on_read(uint32_t addr, uint32_t data);
+
+  Bus*     target;
+  uint32_t shadow[128];
+  uint32_t known[4] = {}; // bit per address, 1 if shadow[addr] is valid
+  bool     dmcontrol_w1_sent = false; // last DMCONTROL write set a W1 bit
+};
+
+//------------------------------------------------------------------------------
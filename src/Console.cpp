@@ -4,6 +4,9 @@
 #include "RVDebug.h"
 #include "WCHFlash.h"
 #include "SoftBreak.h"
+#include "PicoSWIO.h"
+#include "QueueBus.h"
+#include "TracingBus.h"
 #include "test/picorvd_tests.h"
 #ifdef INCLUDE_BLINKY_BINARY
 #include "example/bin/blink.h"
@@ -14,10 +17,13 @@
 
 //------------------------------------------------------------------------------
 
-Console::Console(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft) {
+Console::Console(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft, PicoSWIO* swio, QueueBus* queue, TracingBus* trace) {
   this->rvd = rvd;
   this->flash = flash;
   this->soft = soft;
+  this->swio = swio;
+  this->queue = queue;
+  this->trace = trace;
 }
 
 void Console::reset() {
@@ -30,6 +36,16 @@ void Console::start() {
   printf_y("\n>> ");
 }
 
+//------------------------------------------------------------------------------
+// PicoSWIO belongs to core1 once QueueBus is running, so timing changes run
+// there in order with the queued traffic.
+
+static SWIOTiming set_swio_timing(Console& c, SWIOTiming t) {
+  struct Args { PicoSWIO* swio; SWIOTiming t; } args = { c.swio, t };
+  c.queue->call([](void* p) { auto a = (Args*)p; a->t = a->swio->set_timing(a->t); }, &args);
+  return args.t;
+}
+
 //------------------------------------------------------------------------------
 
 struct ConsoleHandler {
@@ -93,7 +109,8 @@ ConsoleHandler handlers[] = {
   {
     "step",
     [](Console& c) {
-      if (c.rvd->step()) {
+      auto count = c.packet.take_int().ok_or(1);
+      if (c.rvd->step_n(count)) {
         printf_g("Stepped to DPC = 0x%08x\n", c.rvd->get_dpc());
       }
       else {
@@ -159,6 +176,73 @@ ConsoleHandler handlers[] = {
   { "soft_resume", [](Console& c) { c.soft->resume();         } },
   { "soft_step",   [](Console& c) { c.soft->step();           } },
 
+  {
+    "stats",
+    [](Console& c) {
+      static char buf[4096];
+      c.swio->stats.format(buf, sizeof(buf));
+      printf("%s", buf);
+    }
+  },
+
+  { "stats_reset", [](Console& c) { c.rvd->reset_stats(); } },
+
+  { "trace_start", [](Console& c) { c.trace->start(); } },
+  { "trace_stop",  [](Console& c) { c.trace->stop();  } },
+  { "trace_clear", [](Console& c) { c.trace->clear(); } },
+  { "trace_dump",  [](Console& c) { c.trace->dump();  } },
+
+  {
+    // Measures DMI reads per second for a range of stop gaps and bit gaps.
+    // The stop sweep ends where PicoSWIO clamps it to the spec's stop gap.
+    "swio_bench",
+    [](Console& c) {
+      const int reads = 500;
+      auto saved = c.swio->get_timing();
+      uint32_t expect = c.rvd->get_dmstatus();
+
+      // Prints and returns the timing PicoSWIO actually applied.
+      auto bench = [&](SWIOTiming t) {
+        t = set_swio_timing(c, t);
+        int errors = 0;
+        uint32_t time_a = time_us_32();
+        for (int i = 0; i < reads; i++) {
+          if (c.rvd->get_dmstatus() != expect) errors++;
+        }
+        uint32_t time_b = time_us_32();
+        printf("long %2d gap %2d stop %2d : %8.1f tx/sec, %d errors\n",
+               t.long_delay, t.gap_delay, t.stop_ticks,
+               1000000.0 * float(reads) / float(time_b - time_a), errors);
+        return t;
+      };
+
+      for (int stop = 32; stop >= 2; stop -= 2) {
+        SWIOTiming t = saved;
+        t.stop_ticks = stop;
+        if (bench(t).stop_ticks != stop) break;
+      }
+      for (int gap = 4; gap >= 0; gap--) {
+        SWIOTiming t = saved;
+        t.gap_delay = gap;
+        bench(t);
+      }
+
+      set_swio_timing(c, saved);
+    }
+  },
+
+  {
+    "swio_timing",
+    [](Console& c) {
+      SWIOTiming t = c.swio->get_timing();
+      t.long_delay = c.packet.take_int().ok_or(t.long_delay);
+      t.gap_delay  = c.packet.take_int().ok_or(t.gap_delay);
+      t.stop_ticks = c.packet.take_int().ok_or(t.stop_ticks);
+      t = set_swio_timing(c, t);
+      printf("long %d gap %d stop %d\n", t.long_delay, t.gap_delay, t.stop_ticks);
+    }
+  },
+
   {
     "dump_bp",
     [](Console& c) {
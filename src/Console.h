@@ -4,9 +4,12 @@
 struct RVDebug;
 struct WCHFlash;
 struct SoftBreak;
+struct PicoSWIO;
+struct QueueBus;
+struct TracingBus;
 
 struct Console {
-  Console(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft);
+  Console(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft, PicoSWIO* swio, QueueBus* queue, TracingBus* trace);
   void reset();
   void dump();
   void start();
@@ -20,4 +23,7 @@ struct Console {
   RVDebug* rvd;
   WCHFlash* flash;
   SoftBreak* soft;
+  PicoSWIO* swio;
+  QueueBus* queue;
+  TracingBus* trace;
 };
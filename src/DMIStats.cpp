@@ -0,0 +1,63 @@
+#include "DMIStats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+void DMIStats::reset() {
+  memset(gets, 0, sizeof(gets));
+  memset(puts, 0, sizeof(puts));
+  memset(hist, 0, sizeof(hist));
+  frames = 0;
+  prog_loads = 0;
+  prog_resident = 0;
+  prog_words = 0;
+}
+
+//------------------------------------------------------------------------------
+
+int DMIStats::format(char* buf, int size) const {
+  static const char* kind_names[KIND_COUNT] = { "get", "put", "batch", "repeat", "poll" };
+
+  int len = 0;
+  auto print = [&](const char* fmt, auto... args) {
+    if (len < size) len += snprintf(buf + len, size - len, fmt, args...);
+  };
+
+  print("%-16s %10s %10s\n", "reg", "gets", "puts");
+  for (int addr = 0; addr < 128; addr++) {
+    if (!gets[addr] && !puts[addr]) continue;
+    if (regname) {
+      print("%-16s %10u %10u\n", regname(addr), gets[addr], puts[addr]);
+    }
+    else {
+      print("0x%02x             %10u %10u\n", addr, gets[addr], puts[addr]);
+    }
+  }
+  print("frames %u, bits on wire %llu\n", frames, (unsigned long long)bits_on_wire());
+  print("programs loaded %u, already resident %u, words uploaded %u\n",
+        prog_loads, prog_resident, prog_words);
+
+  print("latency (usec)\n");
+  for (int kind = 0; kind < KIND_COUNT; kind++) {
+    print("  %-6s", kind_names[kind]);
+    for (int i = 0; i < hist_size; i++) {
+      if (!hist[kind][i]) continue;
+      if (i == 0) {
+        print(" <1:%u", hist[kind][i]);
+      }
+      else if (i == hist_size - 1) {
+        print(" >=%u:%u", 1u << (i - 1), hist[kind][i]);
+      }
+      else {
+        print(" %u-%u:%u", 1u << (i - 1), (1u << i) - 1, hist[kind][i]);
+      }
+    }
+    print("\n");
+  }
+
+  return len < size ? len : size - 1;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,74 @@
+// Always-on counters for debug module interface traffic.
+
+#pragma once
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+
+struct DMIStats {
+  // Bus calls we time separately. A batch or repeat covers many frames.
+  enum Kind {
+    GET,
+    PUT,
+    BATCH,
+    REPEAT,
+    POLL,
+    KIND_COUNT,
+  };
+
+  // Start bit + 7 address bits + read/write bit + 32 data bits.
+  static const int bits_per_frame = 41;
+
+  // Latency bucket N holds calls that took [2^(N-1), 2^N) usec, bucket 0 is
+  // "under a microsecond" and the last bucket catches everything slower.
+  static const int hist_size = 16;
+
+  void reset();
+
+  void on_get(uint32_t addr, int count = 1) {
+    gets[addr & 0x7F] += count;
+    frames += count;
+  }
+
+  void on_put(uint32_t addr) {
+    puts[addr & 0x7F]++;
+    frames++;
+  }
+
+  void on_call(Kind kind, uint32_t usec) {
+    int bucket = 0;
+    while (usec && bucket < hist_size - 1) {
+      usec >>= 1;
+      bucket++;
+    }
+    hist[kind][bucket]++;
+  }
+
+  // One call per RVDebug::load_prog(), 'words' is how many progbuf words it
+  // had to upload.
+  void on_prog_load(int words) {
+    prog_loads++;
+    prog_words += words;
+    if (!words) prog_resident++;
+  }
+
+  uint64_t bits_on_wire() const { return uint64_t(frames) * bits_per_frame; }
+
+  // Writes a human-readable report into buf and returns its length. Registers
+  // with no traffic are skipped.
+  int format(char* buf, int size) const;
+
+  // Set by the bus so the report can name its registers.
+  const char* (*regname)(uint8_t addr) = nullptr;
+
+  uint32_t gets[128] = {};
+  uint32_t puts[128] = {};
+  uint32_t frames = 0;
+  uint32_t hist[KIND_COUNT][hist_size] = {};
+
+  uint32_t prog_loads = 0;    // programs loaded
+  uint32_t prog_resident = 0; // ...that were already in the progbuf
+  uint32_t prog_words = 0;    // progbuf words uploaded
+};
+
+//------------------------------------------------------------------------------
@@ -4,6 +4,8 @@
 #include "SoftBreak.h"
 #include "RVDebug.h"
 #include "WCHFlash.h"
+#include "DMIStats.h"
+#include "TracingBus.h"
 
 #include <ctype.h>
 #include "hardware/timer.h"
@@ -33,10 +35,11 @@ const char* memory_map = R"(<?xml version="1.0"?>
 
 //------------------------------------------------------------------------------
 
-GDBServer::GDBServer(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft) {
+GDBServer::GDBServer(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft, DMIStats* stats) {
   this->rvd = rvd;
   this->flash = flash;
   this->soft = soft;
+  this->stats = stats;
   this->page_cache = new uint8_t[flash->get_page_size()];
 }
 
@@ -159,11 +162,7 @@ void GDBServer::handle_g() {
 
   if (!recv.error) {
     uint32_t buf1[17];
-
-    for (int i = 0; i < rvd->get_gpr_count(); i++) {
-      buf1[i] = rvd->get_gpr(i);
-    }
-    buf1[16] = rvd->get_dpc();
+    rvd->get_gprs(buf1);
 
     send.start_packet();
     for (int i = 0; i < 17; i++) {
@@ -183,10 +182,11 @@ void GDBServer::handle_g() {
 void GDBServer::handle_G() {
   recv.take('G');
 
-  for(int i = 0; i < rvd->get_gpr_count(); i++) {
-    rvd->set_gpr(i, recv.take_hex(8));
+  uint32_t buf1[17];
+  for(int i = 0; i < 17; i++) {
+    buf1[i] = recv.take_hex(8);
   }
-  rvd->set_dpc(recv.take_hex(8));
+  if (!recv.error) rvd->set_gprs(buf1);
 
   send.set_packet(recv.error ? "E01" : "OK");
   next_state = SEND_PREFIX;
@@ -244,20 +244,14 @@ void GDBServer::handle_m() {
       src += 4;
       len -= 4;
     }
-    else if ((src & 3) == 0 && len >= 4) {
-      int chunk = len & ~3;
+    else {
+      int chunk = len;
       if (chunk > sizeof(buf)) chunk = sizeof(buf);
-      rvd->get_block_aligned(src, buf, chunk);
+      rvd->get_block_unaligned(src, buf, chunk);
       send.put_hex_blob(buf, chunk);
       src += chunk;
       len -= chunk;
     }
-    else {
-      auto x = rvd->get_mem_u8(src);
-      send.put_hex_u8(x >> 0);
-      src += 1;
-      len -= 1;
-    }
   }
 
   send.end_packet();
@@ -284,21 +278,14 @@ void GDBServer::handle_M() {
 
   uint32_t buf[256];
 
-  while (len) {
-    if ((dst & 3) == 0 && len >= 4) {
-      int chunk = len & ~3;
-      if (chunk > sizeof(buf)) chunk = sizeof(buf);
-      recv.take_blob(buf, chunk);
-      rvd->set_block_aligned(dst, buf, chunk);
-      dst += chunk;
-      len -= chunk;
-    }
-    else {
-      uint8_t x = (uint8_t)recv.take_hex(2);
-      rvd->set_mem_u8(dst, x);
-      dst += 1;
-      len -= 1;
+  while (len && !recv.error) {
+    int chunk = len;
+    if (chunk > sizeof(buf)) chunk = sizeof(buf);
+    if (recv.take_blob(buf, chunk)) {
+      rvd->set_block_unaligned(dst, buf, chunk);
     }
+    dst += chunk;
+    len -= chunk;
   }
 
   send.set_packet(recv.error ? "E01" : "OK");
@@ -365,6 +352,32 @@ void GDBServer::handle_q() {
     // ‘E NN’ A badly formed request or an error was encountered.
     send.set_packet("1");
   }
+  else if (recv.match_prefix("qCRC:")) {
+    // -> qCRC:addr,length
+    // CRC-32 of target memory, for "compare-sections". Has to come before
+    // "qC", which is a prefix of it.
+    // Reply: 'C<crc32>'
+    uint32_t addr = recv.take_hex();
+    recv.take(',');
+    int length = recv.take_hex();
+
+    uint32_t crc = 0;
+    if (!recv.error) crc = rvd->crc32(addr, length);
+
+    if (recv.error || rvd->get_abstractcs().CMDER) {
+      rvd->clear_err();
+      send.set_packet("E01");
+    }
+    else {
+      send.start_packet();
+      send.put('C');
+      send.put_hex_u8(crc >> 24);
+      send.put_hex_u8(crc >> 16);
+      send.put_hex_u8(crc >> 8);
+      send.put_hex_u8(crc >> 0);
+      send.end_packet();
+    }
+  }
   else if (recv.match_prefix("qC")) {
     // -> qC
     // Return current thread ID
@@ -381,6 +394,35 @@ void GDBServer::handle_q() {
     // Query all active thread IDs, continued
     send.set_packet("l");
   }
+  else if (recv.match_prefix("qSearch:memory:")) {
+    // -> qSearch:memory:addr;length;pattern
+    // The pattern is binary and runs to the end of the packet.
+    // Reply: '0' not found, '1,addr' found
+    uint32_t addr = recv.take_hex();
+    recv.take(';');
+    int length = recv.take_hex();
+    recv.take(';');
+    const char* pattern = recv.cursor2;
+    int pattern_len = recv.size - (recv.cursor2 - recv.buf);
+    recv.cursor2 = recv.buf + recv.size;
+
+    uint32_t found = 0;
+    bool hit = !recv.error && rvd->search_mem(addr, length, pattern, pattern_len, found);
+
+    if (recv.error || rvd->get_abstractcs().CMDER) {
+      rvd->clear_err();
+      send.set_packet("E01");
+    }
+    else if (!hit) {
+      send.set_packet("0");
+    }
+    else {
+      send.start_packet();
+      send.put_str("1,");
+      for (int i = 28; i >= 0; i -= 4) send.put(to_hex((found >> i) & 0xF));
+      send.end_packet();
+    }
+  }
   else if (recv.match_prefix("qSupported")) {
     // FIXME we're ignoring the contents of qSupported
     recv.cursor2 = recv.buf + recv.size;
@@ -413,6 +455,18 @@ void GDBServer::handle_q() {
       soft->reset();
       send.set_packet("OK");
     }
+    else if (recv.match_prefix_hex("stats reset")) {
+      rvd->reset_stats();
+      send.set_packet("OK");
+    }
+    else if (recv.match_prefix_hex("stats")) {
+      // Reply is the report text, hex encoded
+      static char buf[4096];
+      int len = stats->format(buf, sizeof(buf));
+      send.start_packet();
+      send.put_hex_blob(buf, len);
+      send.end_packet();
+    }
   }
 
 
@@ -659,6 +713,7 @@ void GDBServer::handle_packet() {
   }
 
   if (h) {
+    if (trace) trace->mark(recv.buf);
     recv.cursor2 = recv.buf;
     send.clear();
     (*this.*h)();
@@ -5,13 +5,15 @@
 struct RVDebug;
 struct WCHFlash;
 struct SoftBreak;
+struct DMIStats;
+struct TracingBus;
 
 //------------------------------------------------------------------------------
 
 struct GDBServer {
 public:
 
-  GDBServer(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft);
+  GDBServer(RVDebug* rvd, WCHFlash* flash, SoftBreak* soft, DMIStats* stats);
   void reset();
   void dump();
 
@@ -65,6 +67,10 @@ public:
   RVDebug* rvd = nullptr;
   WCHFlash* flash = nullptr;
   SoftBreak* soft = nullptr;
+  DMIStats* stats = nullptr;
+
+  // If set, each packet starts a new phase in the DMI trace.
+  TracingBus* trace = nullptr;
 
   Packet   send;
   Packet   recv;
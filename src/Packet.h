@@ -224,7 +224,7 @@ struct Packet {
 
     for (int i = 0; i < size; i++) {
       int lo = 0, hi = 0;
-      if (((cursor2 - buf) <= size - 2) &&
+      if (((cursor2 - buf) <= this->size - 2) &&
           from_hex(cursor2[0], hi) &&
           from_hex(cursor2[1], lo)) {
         *dst++ = (hi << 4) | lo;
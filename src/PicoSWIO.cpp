@@ -1,44 +1,87 @@
 #include "PicoSWIO.h"
 #include "bin/singlewire.pio.h"
 #include "debug_defines.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/timer.h"
+
+#include <math.h>
 
 #include "utils.h"
 
 //#define DUMP_COMMANDS
 
-__attribute__((noinline)) void busy_wait(int count) {
-  volatile int c = count;
-  while (c) c = c - 1;
-}
-
 // WCH-specific debug interface config registers
 static const int WCH_DM_CPBR     = 0x7C;
 static const int WCH_DM_CFGR     = 0x7D;
 static const int WCH_DM_SHDWCFGR = 0x7E;
 static const int WCH_DM_PART     = 0x7F; // not in doc but appears to be part info
 
+// KEY = 0x5AA5, OUTEN = 1, normal mode timings.
+static const uint32_t WCH_CFGR_NORMAL = 0x5AA50400;
+
+// TDIVCFG/SOPNCFG values we ask for when switching to fast mode. The target
+// reports what it actually accepted in CPBR.TDIV/SOPN.
+static const int WCH_TDIV_FAST = 1;
+static const int WCH_SOPN_FAST = 1;
+
 //------------------------------------------------------------------------------
 
-void PicoSWIO::reset(int pin) {
+void PicoSWIO::reset(int pin, bool try_fast) {
   CHECK(pin != -1);
   this->pin = pin;
+  stats.regname = addr_to_regname;
 
   // Configure GPIO
   gpio_set_drive_strength(pin, GPIO_DRIVE_STRENGTH_2MA);
   gpio_set_slew_rate     (pin, GPIO_SLEW_RATE_SLOW);
   gpio_set_function      (pin, GPIO_FUNC_PIO0);
 
+  // Grab DMA channels for transact()
+  if (dma_tx == -1) dma_tx = dma_claim_unused_channel(true);
+  if (dma_rx == -1) dma_rx = dma_claim_unused_channel(true);
+
+  // Find the fastest divider this link can handle before we talk to the DM.
+  calibrate();
+
+  // The target always comes out of a reset pulse in normal mode.
+  start_pio(false);
+  reset_pulse();
+
+  // Enable debug output pin on target
+  put(WCH_DM_SHDWCFGR, WCH_CFGR_NORMAL);
+  put(WCH_DM_CFGR,     WCH_CFGR_NORMAL);
+
+  fast_mode = try_fast && enable_fast_mode();
+
+  start_poll_pio();
+
+  // Reset debug module on target
+  put(DM_DMCONTROL, 0x00000000);
+  put(DM_DMCONTROL, 0x00000001);
+}
+
+//------------------------------------------------------------------------------
+// (Re)load the PIO program for normal or fast mode timings and start the state
+// machine. Anything still in the TX FIFO is lost, so call flush() first.
+
+void PicoSWIO::start_pio(bool fast) {
   // Reset PIO module
   pio0->ctrl = 0b000100010001;
   pio_sm_set_enabled(pio0, pio_sm, false);
 
-  // Upload PIO program
+  // Upload PIO program. Both programs don't fit in instruction memory at the
+  // same time, so we swap them.
   pio_clear_instruction_memory(pio0);
-  uint pio_offset = pio_add_program(pio0, &singlewire_program);
+  auto program     = fast ? &singlewire_fast_program   : &singlewire_program;
+  uint wrap_target = fast ? singlewire_fast_wrap_target : singlewire_wrap_target;
+  uint wrap        = fast ? singlewire_fast_wrap        : singlewire_wrap;
+  uint pio_offset  = pio_add_program(pio0, program);
+  patch_timing(fast, pio_offset);
 
   // Configure PIO module
   pio_sm_config c = pio_get_default_sm_config();
-  sm_config_set_wrap        (&c, pio_offset + singlewire_wrap_target, pio_offset + singlewire_wrap);
+  sm_config_set_wrap        (&c, pio_offset + wrap_target, pio_offset + wrap);
   sm_config_set_sideset     (&c, 1, /*optional*/ false, /*pindirs*/ true);
   sm_config_set_out_pins    (&c, pin, 1);
   sm_config_set_in_pins     (&c, pin);
@@ -47,37 +90,289 @@ void PicoSWIO::reset(int pin) {
   sm_config_set_out_shift   (&c, /*shift_right*/ false, /*autopull*/ false, /*pull_threshold*/ 32);
   sm_config_set_in_shift    (&c, /*shift_right*/ false, /*autopush*/ true,  /*push_threshold*/ 32);
 
-  // 125 mhz / 12 = 96 nanoseconds per tick, close enough to 100 ns.
-  sm_config_set_clkdiv      (&c, 12);
+  // The program's delays are written in ticks of ~100 ns. Derive the divider
+  // from the actual system clock so overclocking the Pico doesn't change the
+  // wire timing - 125 mhz gives a divider of 12.
+  clkdiv = float(clock_get_hz(clk_sys)) * tick_ns * 1.0e-9f;
+  if (clkdiv < 1.0f) clkdiv = 1.0f;
+  sm_config_set_clkdiv      (&c, clkdiv);
 
   pio_sm_init       (pio0, pio_sm, pio_offset, &c);
   pio_sm_set_pins   (pio0, pio_sm, 0);
   pio_sm_set_enabled(pio0, pio_sm, true);
+}
+
+//------------------------------------------------------------------------------
+// Instructions whose delays we patch, see the public labels in singlewire.pio.
+// The stop time is split over the two instructions after each frame.
+
+struct TimingLabels {
+  uint addr_long, addr_zero, data_long, data_zero, read_stop, write_stop;
+};
+
+static const TimingLabels normal_labels = {
+  singlewire_offset_addr_long, singlewire_offset_addr_zero,
+  singlewire_offset_data_long, singlewire_offset_data_zero,
+  singlewire_offset_read_stop, singlewire_offset_write_stop,
+};
+
+static const TimingLabels fast_labels = {
+  singlewire_fast_offset_addr_long, singlewire_fast_offset_addr_zero,
+  singlewire_fast_offset_data_long, singlewire_fast_offset_data_zero,
+  singlewire_fast_offset_read_stop, singlewire_fast_offset_write_stop,
+};
+
+// With one side-set bit the delay lives in bits 11:8.
+static void set_delay(PIO pio, uint addr, int delay) {
+  if (delay < 0) return;
+  if (delay > 15) delay = 15;
+  auto instr = pio->instr_mem[addr];
+  pio->instr_mem[addr] = (instr & ~0x0F00) | (delay << 8);
+}
+
+// Spreads 'ticks' of stop time over the two instructions at 'addr'.
+static void set_stop(PIO pio, uint addr, int ticks) {
+  int delay_b = ticks - 2 > 15 ? 15 : ticks - 2;
+  int delay_a = ticks - 2 - delay_b > 15 ? 15 : ticks - 2 - delay_b;
+  set_delay(pio, addr,     delay_a);
+  set_delay(pio, addr + 1, delay_b);
+}
+
+// The requested delay, or else the one the program was assembled with,
+// stretched or shrunk so the pulse - the instruction plus 'fixed' ticks before
+// it - lasts as long as it does at tick_ns_default.
+int PicoSWIO::pick_delay(const pio_program* program, uint32_t label, int delay, int fixed) {
+  if (delay < 0) {
+    int assembled = (program->instructions[label] >> 8) & 0xF;
+    int ticks = int(ceilf((fixed + 1 + assembled) * tick_ns_default / tick_ns));
+    delay = ticks - fixed - 1;
+  }
+  return delay < 0 ? 0 : delay > 15 ? 15 : delay;
+}
+
+// A long pulse is the two instructions of a short one plus the 'long'
+// instruction, the pull-up is just the 'zero' instruction.
+void PicoSWIO::patch_timing(bool fast, uint32_t offset) {
+  auto& l = fast ? fast_labels : normal_labels;
+  auto program = fast ? &singlewire_fast_program : &singlewire_program;
+
+  int long_delay = pick_delay(program, l.addr_long, timing.long_delay, 2);
+  int gap_delay  = pick_delay(program, l.addr_zero, timing.gap_delay, 0);
+  set_delay(pio0, offset + l.addr_long, long_delay);
+  set_delay(pio0, offset + l.data_long, long_delay);
+  set_delay(pio0, offset + l.addr_zero, gap_delay);
+  set_delay(pio0, offset + l.data_zero, gap_delay);
+
+  set_stop(pio0, offset + l.read_stop,  stop_ticks(fast));
+  set_stop(pio0, offset + l.write_stop, stop_ticks(fast));
+}
+
+// The requested stop time (or the program's own), but never less time than
+// the program's stop takes at tick_ns_default.
+int PicoSWIO::stop_ticks(bool fast) {
+  int base = fast ? stop_ticks_fast : stop_ticks_normal;
+  int min_ticks = int(ceilf(base * tick_ns_default / tick_ns));
+  int ticks = timing.stop_ticks < 0 ? base : timing.stop_ticks;
+  if (ticks < min_ticks) ticks = min_ticks;
+  if (ticks > stop_ticks_max) ticks = stop_ticks_max;
+  return ticks;
+}
+
+SWIOTiming PicoSWIO::set_timing(const SWIOTiming& t) {
+  flush();
+  timing = t;
+  start_pio(fast_mode);
+  start_poll_pio();
+
+  auto& l = fast_mode ? fast_labels : normal_labels;
+  auto program = fast_mode ? &singlewire_fast_program : &singlewire_program;
 
+  SWIOTiming applied;
+  applied.long_delay = pick_delay(program, l.addr_long, timing.long_delay, 2);
+  applied.gap_delay  = pick_delay(program, l.addr_zero, timing.gap_delay, 0);
+  applied.stop_ticks = stop_ticks(fast_mode);
+  return applied;
+}
+
+//------------------------------------------------------------------------------
+// The poll program lives in PIO1 and stays loaded. It only owns the pin while
+// poll() is running, and only in normal mode, so it always gets the normal
+// mode delays.
+
+void PicoSWIO::start_poll_pio() {
+  if (poll_offset == -1) poll_offset = pio_add_program(pio1, &singlewire_poll_program);
+  pio_sm_set_enabled(pio1, poll_sm, false);
+
+  uint addr_long = singlewire_poll_offset_addr_long;
+  uint addr_zero = singlewire_poll_offset_addr_zero;
+  set_delay(pio1, poll_offset + addr_long, pick_delay(&singlewire_poll_program, addr_long, timing.long_delay, 2));
+  set_delay(pio1, poll_offset + addr_zero, pick_delay(&singlewire_poll_program, addr_zero, timing.gap_delay, 0));
+  set_stop (pio1, poll_offset + singlewire_poll_offset_stop, stop_ticks(false));
+
+  pio_sm_config c = pio_get_default_sm_config();
+  sm_config_set_wrap        (&c, poll_offset + singlewire_poll_wrap_target, poll_offset + singlewire_poll_wrap);
+  sm_config_set_sideset     (&c, 1, /*optional*/ false, /*pindirs*/ true);
+  sm_config_set_sideset_pins(&c, pin);
+  sm_config_set_jmp_pin     (&c, pin);
+  sm_config_set_out_shift   (&c, /*shift_right*/ false, /*autopull*/ false, /*pull_threshold*/ 32);
+  sm_config_set_in_shift    (&c, /*shift_right*/ false, /*autopush*/ false, /*push_threshold*/ 32);
+  sm_config_set_clkdiv      (&c, clkdiv);
+
+  pio_sm_init                    (pio1, poll_sm, poll_offset, &c);
+  pio_sm_set_pins                (pio1, poll_sm, 0);
+  pio_sm_set_consecutive_pindirs (pio1, poll_sm, pin, 1, false);
+  pio_sm_set_enabled             (pio1, poll_sm, true);
+}
+
+//------------------------------------------------------------------------------
+
+void PicoSWIO::reset_pulse() {
   // Grab pin and send an 8 usec low pulse to reset debug module
   // If we use the sdk functions to do this we get jitter :/
+  uint32_t cycles = uint32_t(uint64_t(clock_get_hz(clk_sys)) * reset_pulse_ns / 1000000000);
   sio_hw->gpio_clr    = (1 << pin);
   sio_hw->gpio_oe_set = (1 << pin);
   iobank0_hw->io[pin].ctrl = GPIO_FUNC_SIO << IO_BANK0_GPIO0_CTRL_FUNCSEL_LSB;
-  busy_wait(100); // ~8 usec
+  busy_wait_at_least_cycles(cycles);
   sio_hw->gpio_oe_clr = (1 << pin);
   iobank0_hw->io[pin].ctrl = GPIO_FUNC_PIO0 << IO_BANK0_GPIO0_CTRL_FUNCSEL_LSB;
+}
 
-  // Enable debug output pin on target
-  put(WCH_DM_SHDWCFGR, 0x5AA50400);
-  put(WCH_DM_CFGR,     0x5AA50400);
+//------------------------------------------------------------------------------
+// Wait until the state machine has sent everything in the TX FIFO and is
+// stalled waiting for the next command.
+
+void PicoSWIO::flush() {
+  const uint32_t stall_bit = 1u << (PIO_FDEBUG_TXSTALL_LSB + pio_sm);
+  while (!pio_sm_is_tx_fifo_empty(pio0, pio_sm)) {}
+  pio0->fdebug = stall_bit;
+  while (!(pio0->fdebug & stall_bit)) {}
+}
 
-  // Reset debug module on target
-  put(DM_DMCONTROL, 0x00000000);
-  put(DM_DMCONTROL, 0x00000001);
+//------------------------------------------------------------------------------
+// Sweep the PIO tick length from slow to fast, resetting the interface and
+// reading the part ID a burst of times at each step. The first step that
+// returns a clean, consistent part ID sets the reference value. The long pulse
+// and the pull-up keep their default widths in nanoseconds, so the sweep finds
+// the limit of the fixed-tick parts of a frame - the short pulse and the read
+// bit timing. We take the fastest passing tick and back off by a proportional
+// margin, staying inside the run of passing ticks so a narrow window ends up in
+// the middle. If even the shortest tick we sweep passes, the edge is lower
+// still and the margin is only bigger.
+//
+// With the tick settled we shorten the pull-up one tick at a time while the
+// reads still pass, and keep one tick more than the shortest that did. The
+// stop time is already at the spec minimum, see stop_ticks().
+
+bool PicoSWIO::calibrate() {
+  bool pass[calib_steps];
+  uint32_t ref = 0;
+  timing = SWIOTiming();
+
+  auto check = [&]() {
+    start_pio(false);
+    reset_pulse();
+    put(WCH_DM_SHDWCFGR, WCH_CFGR_NORMAL);
+    put(WCH_DM_CFGR,     WCH_CFGR_NORMAL);
+
+    uint32_t parts[calib_reads];
+    get_repeat(WCH_DM_PART, parts, calib_reads);
+
+    bool same = true;
+    for (int j = 1; j < calib_reads; j++) same &= parts[j] == parts[0];
+    if (!ref && same && parts[0] != 0x00000000 && parts[0] != 0xFFFFFFFF) ref = parts[0];
+    return ref && same && parts[0] == ref;
+  };
+
+  for (int i = calib_steps - 1; i >= 0; i--) {
+    tick_ns = calib_min_ns + i * calib_step_ns;
+    pass[i] = check();
+  }
+
+  int fastest = 0;
+  while (fastest < calib_steps && !pass[fastest]) fastest++;
+
+  if (fastest == calib_steps) {
+    LOG_R("PicoSWIO::calibrate() - No part ID at any tick length, using default\n");
+    tick_ns = tick_ns_default;
+    return false;
+  }
+
+  int slowest = fastest;
+  while (slowest + 1 < calib_steps && pass[slowest + 1]) slowest++;
+
+  float fastest_ns = calib_min_ns + fastest * calib_step_ns;
+  float slowest_ns = calib_min_ns + slowest * calib_step_ns;
+
+  tick_ns = fastest_ns * calib_margin;
+  if (tick_ns > (fastest_ns + slowest_ns) / 2) tick_ns = (fastest_ns + slowest_ns) / 2;
+
+  int gap_default = pick_delay(&singlewire_program, singlewire_offset_addr_zero, -1, 0);
+  int gap = gap_default;
+  while (gap > 0) {
+    timing.gap_delay = gap - 1;
+    if (!check()) break;
+    gap--;
+  }
+  gap = gap + 1 < gap_default ? gap + 1 : gap_default;
+  timing.gap_delay = gap < gap_default ? gap : -1;
+
+  LOG("PicoSWIO::calibrate() - Pass from %f ns to %f ns, using %f ns per tick, gap delay %d of %d\n",
+      fastest_ns, slowest_ns, tick_ns, gap, gap_default);
+  return true;
 }
 
+//------------------------------------------------------------------------------
+// Ask the target to switch to fast mode, switch our own timings over, and check
+// that we can still read the part ID. If anything goes wrong we pulse reset
+// again, which puts the target back in normal mode.
+
+bool PicoSWIO::enable_fast_mode() {
+  uint32_t part = get_partid();
+  if (part == 0x00000000 || part == 0xFFFFFFFF) {
+    LOG_R("PicoSWIO::enable_fast_mode() - No part ID, not trying fast mode\n");
+    return false;
+  }
+
+  Reg_CFGR cfgr = WCH_CFGR_NORMAL;
+  cfgr.TDIVCFG = WCH_TDIV_FAST;
+  cfgr.SOPNCFG = WCH_SOPN_FAST;
+  put(WCH_DM_SHDWCFGR, cfgr);
+  put(WCH_DM_CFGR,     cfgr);
+  flush();
+
+  start_pio(true);
+
+  auto cpbr = get_cpbr();
+  if (get_partid() == part && cpbr.TDIV == WCH_TDIV_FAST && cpbr.SOPN == WCH_SOPN_FAST) {
+    return true;
+  }
+
+  LOG_R("PicoSWIO::enable_fast_mode() - Verify failed, falling back to normal mode\n");
+  flush();
+  start_pio(false);
+  reset_pulse();
+  put(WCH_DM_SHDWCFGR, WCH_CFGR_NORMAL);
+  put(WCH_DM_CFGR,     WCH_CFGR_NORMAL);
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Command words are the inverted 7-bit address plus the read/write bit. The
+// upper 24 bits are the block repeat count, so they must be zero for a single
+// op.
+
+static uint32_t encode_get(uint32_t addr) { return (((~addr) << 1) | 1) & 0xFF; }
+static uint32_t encode_put(uint32_t addr) { return (((~addr) << 1) | 0) & 0xFF; }
+
 //------------------------------------------------------------------------------
 
 uint32_t PicoSWIO::get(uint32_t addr) {
-  cmd_count++;
-  pio_sm_put_blocking(pio0, 0, ((~addr) << 1) | 1);
+  uint32_t time_a = time_us_32();
+  pio_sm_put_blocking(pio0, 0, encode_get(addr));
   auto data = pio_sm_get_blocking(pio0, 0);
+  stats.on_get(addr);
+  stats.on_call(DMIStats::GET, time_us_32() - time_a);
 #ifdef DUMP_COMMANDS
   printf("get_dbg %15s 0x%08x\n", addr_to_regname(addr), data);
 #endif
@@ -85,14 +380,160 @@ uint32_t PicoSWIO::get(uint32_t addr) {
 }
 
 //------------------------------------------------------------------------------
+// Puts don't wait for the frame to go out, so their latency is only the time
+// spent waiting for room in the TX FIFO.
 
 void PicoSWIO::put(uint32_t addr, uint32_t data) {
-  cmd_count++;
 #ifdef DUMP_COMMANDS
   printf("set_dbg %15s 0x%08x\n", addr_to_regname(addr), data);
 #endif
-  pio_sm_put_blocking(pio0, 0, ((~addr) << 1) | 0);
+  uint32_t time_a = time_us_32();
+  pio_sm_put_blocking(pio0, 0, encode_put(addr));
   pio_sm_put_blocking(pio0, 0, ~data);
+  stats.on_put(addr);
+  stats.on_call(DMIStats::PUT, time_us_32() - time_a);
+}
+
+//------------------------------------------------------------------------------
+// One command word with a repeat count, the PIO replays the read frame and DMA
+// drains the results.
+
+void PicoSWIO::get_repeat(uint32_t addr, uint32_t* data, int count) {
+  while (count) {
+    int block = count < block_max ? count : block_max;
+    uint32_t time_a = time_us_32();
+
+    auto rx_config = dma_channel_get_default_config(dma_rx);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_32);
+    channel_config_set_read_increment    (&rx_config, false);
+    channel_config_set_write_increment   (&rx_config, true);
+    channel_config_set_dreq              (&rx_config, pio_get_dreq(pio0, pio_sm, false));
+    dma_channel_configure(dma_rx, &rx_config, data, &pio0->rxf[pio_sm], block, true);
+
+    pio_sm_put_blocking(pio0, pio_sm, (uint32_t(block - 1) << 8) | encode_get(addr));
+    dma_channel_wait_for_finish_blocking(dma_rx);
+    stats.on_get(addr, block);
+    stats.on_call(DMIStats::REPEAT, time_us_32() - time_a);
+
+#ifdef DUMP_COMMANDS
+    for (int i = 0; i < block; i++) {
+      printf("get_dbg %15s 0x%08x\n", addr_to_regname(addr), data[i]);
+    }
+#endif
+
+    data  += block;
+    count -= block;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Most waits are already satisfied by the first read, so we try a plain get
+// first. Otherwise we patch the bit counts for the polled bit into the poll
+// program, hand the pin to PIO1 until it reports back, then read the final
+// value normally.
+
+uint32_t PicoSWIO::poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) {
+  bool one_bit = mask && !(mask & (mask - 1));
+  if (fast_mode || !one_bit || max_iters < 2 || max_iters > block_max) {
+    return Bus::poll(addr, mask, expect, max_iters, reads);
+  }
+
+  uint32_t first = get(addr);
+  if ((first & mask) == expect) {
+    if (reads) *reads = 1;
+    return first;
+  }
+  max_iters--;
+
+  uint32_t time_a = time_us_32();
+
+  // Keep the side-set and delay bits, swap the 'set x' for a jump past the
+  // loop if there are no bits to skip.
+  auto patch = [&](int label, int bits, int skip_to) {
+    uint16_t keep  = singlewire_poll_program.instructions[label] & 0x1F00;
+    uint16_t instr = bits ? pio_encode_set(pio_x, bits - 1) : pio_encode_jmp(poll_offset + skip_to);
+    pio1->instr_mem[poll_offset + label] = keep | instr;
+  };
+  int bit = __builtin_ctz(mask);
+  patch(singlewire_poll_offset_pre,  31 - bit, singlewire_poll_offset_bit);
+  patch(singlewire_poll_offset_post, bit,      singlewire_poll_offset_stop);
+
+  // The poll program branches on pin high = no match.
+  flush();
+  gpio_set_inover  (pin, (expect & mask) ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+  gpio_set_function(pin, GPIO_FUNC_PIO1);
+
+  pio_sm_put_blocking(pio1, poll_sm, (uint32_t(max_iters - 1) << 8) | encode_get(addr));
+  uint32_t left = pio_sm_get_blocking(pio1, poll_sm);
+
+  gpio_set_function(pin, GPIO_FUNC_PIO0);
+  gpio_set_inover  (pin, GPIO_OVERRIDE_NORMAL);
+
+  int polled = left == 0xFFFFFFFF ? max_iters : max_iters - left;
+  stats.on_get(addr, polled);
+  stats.on_call(DMIStats::POLL, time_us_32() - time_a);
+
+  // Plus the read before the loop and the one after it.
+  if (reads) *reads = polled + 2;
+
+  return get(addr);
+}
+
+//------------------------------------------------------------------------------
+
+void PicoSWIO::transact(const DmiOp* ops, int count, uint32_t* results) {
+  while (count) {
+    // Encode as many ops as will fit in the TX buffer
+    int op_count = 0;
+    int tx_count = 0;
+    int rx_count = 0;
+    while (op_count < count && tx_count + 2 <= tx_buf_size) {
+      auto& op = ops[op_count++];
+#ifdef DUMP_COMMANDS
+      printf("%s_dbg %15s 0x%08x\n", op.write ? "set" : "get", addr_to_regname(op.addr), op.data);
+#endif
+      if (op.write) {
+        tx_buf[tx_count++] = encode_put(op.addr);
+        tx_buf[tx_count++] = ~op.data;
+        stats.on_put(op.addr);
+      }
+      else {
+        tx_buf[tx_count++] = encode_get(op.addr);
+        stats.on_get(op.addr);
+        rx_count++;
+      }
+    }
+    uint32_t time_a = time_us_32();
+
+    // RX channel drains one word per get, TX channel feeds the whole buffer.
+    auto rx_config = dma_channel_get_default_config(dma_rx);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_32);
+    channel_config_set_read_increment    (&rx_config, false);
+    channel_config_set_write_increment   (&rx_config, true);
+    channel_config_set_dreq              (&rx_config, pio_get_dreq(pio0, pio_sm, false));
+
+    auto tx_config = dma_channel_get_default_config(dma_tx);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_32);
+    channel_config_set_read_increment    (&tx_config, true);
+    channel_config_set_write_increment   (&tx_config, false);
+    channel_config_set_dreq              (&tx_config, pio_get_dreq(pio0, pio_sm, true));
+
+    uint32_t mask = (1u << dma_tx);
+    if (rx_count) {
+      dma_channel_configure(dma_rx, &rx_config, results, &pio0->rxf[pio_sm], rx_count, false);
+      mask |= (1u << dma_rx);
+    }
+    dma_channel_configure(dma_tx, &tx_config, &pio0->txf[pio_sm], tx_buf, tx_count, false);
+    dma_start_channel_mask(mask);
+
+    dma_channel_wait_for_finish_blocking(dma_tx);
+    if (rx_count) dma_channel_wait_for_finish_blocking(dma_rx);
+    stats.on_call(DMIStats::BATCH, time_us_32() - time_a);
+
+    ops     += op_count;
+    count   -= op_count;
+    if (results) results += rx_count;
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -122,6 +563,8 @@ uint32_t PicoSWIO::get_partid() {
 //------------------------------------------------------------------------------
 
 void PicoSWIO::dump() {
+  printf("SWIO mode = %s\n", fast_mode ? "fast" : "normal");
+  printf("SWIO tick = %f ns, clkdiv = %f\n", tick_ns, clkdiv);
   get_cpbr().dump();
   get_cfgr().dump();
   get_shdwcfgr().dump();
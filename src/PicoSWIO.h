@@ -4,32 +4,118 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "Bus.h"
+#include "DMIStats.h"
 
 struct Reg_CPBR;
 struct Reg_CFGR;
 struct Reg_SHDWCFGR;
+struct pio_program;
+
+//------------------------------------------------------------------------------
+// Delays patched into the SWIO PIO programs, in ticks. -1 keeps the pulse as
+// long in nanoseconds as the program's own delay makes it at the default tick.
+
+struct SWIOTiming {
+  int long_delay = -1; // Extra low time of a long pulse, 0-15
+  int gap_delay  = -1; // Pull-up time between bits, 0-15
+  int stop_ticks = -1; // Idle time after each frame, up to 32, see stop_ticks()
+};
 
 //------------------------------------------------------------------------------
 
 struct PicoSWIO : public Bus {
-  void reset(int swd_pin);
+  // Resets the debug interface. If try_fast is set, we also try to switch the
+  // target over to fast mode and fall back to normal mode if that fails.
+  void reset(int swd_pin, bool try_fast = true);
 
   uint32_t get(uint32_t addr) override;
   void     put(uint32_t addr, uint32_t data) override;
 
+  // Encodes the whole batch up front and lets DMA feed the PIO FIFOs, so
+  // frames go out back-to-back without the CPU in the loop.
+  void     transact(const DmiOp* ops, int count, uint32_t* results) override;
+  // Uses the PIO block mode - one command word, count frames on the wire.
+  void     get_repeat(uint32_t addr, uint32_t* data, int count) override;
+  // Single-bit masks in normal mode run on the poll program in PIO1, anything
+  // else falls back to reading in a loop.
+  uint32_t poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) override;
+
+  // Sweeps the PIO tick length against repeated part ID reads and keeps the
+  // fastest reliable setting plus a safety margin, then shortens the pull-up
+  // between bits as far as it reliably goes. Called from reset(), leaves the
+  // target in normal mode with the debug module unconfigured.
+  bool     calibrate();
+
   uint32_t get_partid();
+  bool     is_fast_mode() { return fast_mode; }
+
+  // Reloads both PIO programs with new delays and returns what was actually
+  // applied - delays are clamped to what the instructions hold and the stop
+  // time to stop_ticks(). Nothing may be in flight, so behind a QueueBus this
+  // has to run through QueueBus::call().
+  SWIOTiming set_timing(const SWIOTiming& t);
+  SWIOTiming get_timing() { return timing; }
   void     dump();
 
+  static const char* addr_to_regname(uint8_t addr);
+
+  // Traffic counters, always on. Read and reset them from the console or
+  // "monitor stats" in GDB.
+  DMIStats stats;
+
 private:
 
+  void start_pio(bool fast);
+  void patch_timing(bool fast, uint32_t offset);
+  int  pick_delay(const pio_program* program, uint32_t label, int delay, int fixed);
+  int  stop_ticks(bool fast);
+  void start_poll_pio();
+  void reset_pulse();
+  void flush();
+  bool enable_fast_mode();
+
   Reg_CPBR get_cpbr();
   Reg_CFGR get_cfgr();
   Reg_SHDWCFGR get_shdwcfgr();
-  const char* addr_to_regname(uint8_t addr);
 
   int pin = -1;
-  int cmd_count = 0;
   int pio_sm = 0;
+  int poll_sm = 0;
+  int poll_offset = -1;
+  bool fast_mode = false;
+  SWIOTiming timing;
+
+  // PIO timing is kept in nanoseconds and converted to a divider using the
+  // current system clock. Calibration sweeps the tick length from calib_min_ns
+  // upwards in calib_step_ns increments and adds calib_margin to the fastest
+  // passing tick. The long pulse and the pull-up keep their width in
+  // nanoseconds across the sweep, see pick_delay().
+  static constexpr float tick_ns_default = 96.0f;
+  static constexpr float calib_min_ns    = 56.0f;
+  static constexpr float calib_step_ns   = 4.0f;
+  static const int       calib_steps     = 35;
+  static const int       calib_reads     = 64;
+  static constexpr float calib_margin    = 1.25f;
+
+  // Ticks in the stop instructions of singlewire.pio. At tick_ns_default they
+  // meet the spec's minimum stop gap (2250 ns normal, 1250 ns fast), so
+  // shorter ticks get proportionally more of them, up to what the two delay
+  // fields can hold. That also sets the shortest tick we can use.
+  static const int stop_ticks_normal = 18;
+  static const int stop_ticks_fast   = 12;
+  static const int stop_ticks_max    = 32;
+  static_assert(calib_min_ns * stop_ticks_max >= tick_ns_default * stop_ticks_normal);
+  // Same for the 8-tick long pulse, of which the delay field holds 15 ticks.
+  static_assert(calib_min_ns * (15 + 3) >= tick_ns_default * 8);
+  static const int       reset_pulse_ns  = 8000;
+  float tick_ns = tick_ns_default;
+  float clkdiv  = 12.0f;
+
+  int dma_tx = -1;
+  int dma_rx = -1;
+  static const int tx_buf_size = 128;
+  static const int block_max = 1 << 24;
+  uint32_t tx_buf[tx_buf_size];
 };
 
 //------------------------------------------------------------------------------
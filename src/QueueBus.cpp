@@ -0,0 +1,96 @@
+#include "QueueBus.h"
+
+#include "pico/multicore.h"
+
+//------------------------------------------------------------------------------
+
+void QueueBus::start() {
+  multicore_launch_core1(core1_main);
+  multicore_fifo_push_blocking(uint32_t(uintptr_t(this)));
+}
+
+//------------------------------------------------------------------------------
+// Core1 gets the QueueBus pointer through the inter-core FIFO, then serves the
+// ring forever.
+
+void QueueBus::core1_main() {
+  QueueBus* bus = (QueueBus*)uintptr_t(multicore_fifo_pop_blocking());
+  while (1) bus->service();
+}
+
+void QueueBus::service() {
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  if (head.load(std::memory_order_acquire) == t) return;
+
+  auto& r = ring[t & (ring_size - 1)];
+  switch (r.kind) {
+    case GET:        *r.results = target->get(r.addr); break;
+    case PUT:        target->put(r.addr, r.data); break;
+    case TRANSACT:   target->transact(r.ops, r.count, r.results); break;
+    case REPEAT:     target->get_repeat(r.addr, r.results, r.count); break;
+    case POLL:       *r.results = target->poll(r.addr, r.mask, r.data, r.count, (int*)r.arg); break;
+    case INVALIDATE: target->invalidate(); break;
+    case CALL:       r.fn(r.arg); break;
+  }
+
+  // Releasing the slot also publishes the results to core0.
+  tail.store(t + 1, std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t QueueBus::post(const Request& r) {
+  uint32_t h = head.load(std::memory_order_relaxed);
+  while (h - tail.load(std::memory_order_acquire) == ring_size) {
+    if (idle) idle();
+  }
+  ring[h & (ring_size - 1)] = r;
+  head.store(h + 1, std::memory_order_release);
+  return h;
+}
+
+void QueueBus::wait(uint32_t seq) {
+  while (int32_t(tail.load(std::memory_order_acquire) - seq) <= 0) {
+    if (idle) idle();
+  }
+}
+
+void QueueBus::sync() {
+  wait(head.load(std::memory_order_relaxed) - 1);
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t QueueBus::get(uint32_t addr) {
+  uint32_t result = 0;
+  wait(post({GET, addr, 0, 0, 1, nullptr, &result}));
+  return result;
+}
+
+void QueueBus::put(uint32_t addr, uint32_t data) {
+  post({PUT, addr, data, 0, 1, nullptr, nullptr});
+}
+
+void QueueBus::transact(const DmiOp* ops, int count, uint32_t* results) {
+  wait(post({TRANSACT, 0, 0, 0, count, ops, results}));
+}
+
+void QueueBus::get_repeat(uint32_t addr, uint32_t* data, int count) {
+  wait(post({REPEAT, addr, 0, 0, count, nullptr, data}));
+}
+
+void QueueBus::invalidate() {
+  post({INVALIDATE, 0, 0, 0, 0, nullptr, nullptr});
+}
+
+void QueueBus::call(void (*fn)(void*), void* arg) {
+  wait(post({CALL, 0, 0, 0, 0, nullptr, nullptr, fn, arg}));
+}
+
+uint32_t QueueBus::poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) {
+  uint32_t result = 0;
+  wait(post({POLL, addr, expect, mask, max_iters, nullptr, &result, nullptr, reads}));
+  return result;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,73 @@
+// Runs a Bus on core1 and forwards DMI traffic to it through a lock-free
+// single-producer/single-consumer ring. Puts are posted and return right away,
+// gets wait for their completion. While core0 is waiting it calls 'idle', so
+// it can keep servicing USB while the target operation is on the wire.
+
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include "Bus.h"
+
+//------------------------------------------------------------------------------
+
+struct QueueBus : public Bus {
+  QueueBus(Bus* target) : target(target) {}
+
+  // Launches the service loop on core1. Nothing on core0 should touch
+  // 'target' directly after this.
+  void start();
+
+  uint32_t get(uint32_t addr) override;
+  void     put(uint32_t addr, uint32_t data) override;
+  void     transact(const DmiOp* ops, int count, uint32_t* results) override;
+  void     get_repeat(uint32_t addr, uint32_t* data, int count) override;
+  uint32_t poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) override;
+  void     invalidate() override;
+
+  // Runs fn(arg) on core1 after everything queued so far and waits for it.
+  // This is how core0 reaches 'target' itself, e.g. to change SWIO timing.
+  void     call(void (*fn)(void*), void* arg) override;
+
+  // Waits until core1 has finished everything queued so far.
+  void     sync();
+
+  // Called on core0 while waiting for room in the ring or for a completion.
+  void (*idle)() = nullptr;
+
+private:
+
+  enum Kind : uint32_t { GET, PUT, TRANSACT, REPEAT, POLL, INVALIDATE, CALL };
+
+  // Pointers in a request belong to core0 and must stay valid until the
+  // request completes, so only puts are fire-and-forget.
+  struct Request {
+    Kind         kind;
+    uint32_t     addr;
+    uint32_t     data;
+    uint32_t     mask;
+    int          count;
+    const DmiOp* ops;
+    uint32_t*    results;
+    void       (*fn)(void*);
+    void*        arg;
+  };
+
+  uint32_t post(const Request& r);
+  void     wait(uint32_t seq);
+
+  static void core1_main();
+  void service();
+
+  static const int ring_size = 64;
+  static_assert((ring_size & (ring_size - 1)) == 0);
+
+  Bus*    target;
+  Request ring[ring_size];
+
+  // 'head' counts requests posted by core0, 'tail' counts requests completed
+  // by core1. Each side only writes its own counter.
+  std::atomic<uint32_t> head = 0;
+  std::atomic<uint32_t> tail = 0;
+};
+
+//------------------------------------------------------------------------------
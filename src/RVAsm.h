@@ -0,0 +1,319 @@
+// Compile-time assembler for the RV32EC subset we run out of the debug
+// program buffer.
+//
+// Programs are written as a template argument list and assembled into the
+// eight PROGBUF words at compile time:
+//
+//   static constexpr auto prog = rvasm::assemble<
+//     label(0),
+//     c_lw(a1, 0, a0),
+//     c_bnez(a1, L(0))
+//   >();
+//
+// Branches and jumps target labels, which are resolved once the whole program
+// is known. Anything that doesn't encode (register outside x0-x15, immediate
+// out of range, branch too far, program longer than the progbuf) is a compile
+// error. Unused space is filled with c.ebreak.
+//
+// A program that doesn't end in an ebreak gets a c.ebreak appended if there's
+// room, so only the words up to Prog::size ever run and the rest of the
+// progbuf can hold whatever the previous program left there. Prog::hash names
+// the program - two programs with the same hash are the same program.
+
+#pragma once
+#include <array>
+#include <stdint.h>
+
+namespace rvasm {
+
+//------------------------------------------------------------------------------
+
+enum Reg { zero, ra, sp, gp, tp, t0, t1, t2, s0, s1, a0, a1, a2, a3, a4, a5 };
+
+static const int progbuf_words = 8;
+
+struct Prog {
+  std::array<uint32_t, progbuf_words> words;
+  int      size; // words that can run, the rest is padding
+  uint32_t hash; // FNV-1a over size and words[0, size), never 0
+
+  constexpr uint32_t operator[](int i) const { return words[i]; }
+  constexpr const uint32_t* data() const { return words.data(); }
+};
+
+// Not constexpr, so reaching one of these during constant evaluation stops
+// the compile with the message in the call stack.
+inline void bad_register(int) {}
+inline void bad_immediate(int) {}
+inline void bad_label(int) {}
+
+constexpr uint32_t reg(Reg r) {
+  if (r < 0 || r > 15) bad_register(r);
+  return r;
+}
+
+// x8-x15, the registers the 3-bit compressed fields can name.
+constexpr uint32_t creg(Reg r) {
+  if (r < 8 || r > 15) bad_register(r);
+  return r - 8;
+}
+
+constexpr uint32_t imm_signed(int32_t imm, int bits) {
+  if (imm < -(1 << (bits - 1)) || imm >= (1 << (bits - 1))) bad_immediate(imm);
+  return uint32_t(imm) & ((1u << bits) - 1);
+}
+
+constexpr uint32_t imm_unsigned(int32_t imm, int bits, int align = 1) {
+  if (imm < 0 || imm >= (1 << bits) || imm % align) bad_immediate(imm);
+  return uint32_t(imm);
+}
+
+constexpr uint32_t bits(uint32_t x, int hi, int lo) {
+  return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+//------------------------------------------------------------------------------
+// An instruction, a label, or a branch waiting for its label. Has to stay a
+// structural type so it can be a template argument.
+
+struct Label { int id; };
+constexpr Label L(int id) { return { id }; }
+
+enum Fixup : uint8_t { NONE, LABEL, FIX_B, FIX_J, FIX_CB, FIX_CJ };
+
+struct Insn {
+  uint32_t bits;
+  uint8_t  size;  // in bytes, 0 for labels
+  Fixup    fixup;
+  int8_t   label;
+};
+
+constexpr Insn op32(uint32_t bits) { return { bits, 4, NONE, 0 }; }
+constexpr Insn op16(uint32_t bits) { return { bits, 2, NONE, 0 }; }
+constexpr Insn label(int id)       { return { 0, 0, LABEL, int8_t(id) }; }
+
+//------------------------------------------------------------------------------
+// Base formats
+
+constexpr uint32_t r_type(uint32_t f7, Reg rs2, Reg rs1, uint32_t f3, Reg rd, uint32_t op) {
+  return (f7 << 25) | (reg(rs2) << 20) | (reg(rs1) << 15) | (f3 << 12) | (reg(rd) << 7) | op;
+}
+
+constexpr uint32_t i_type(int32_t imm, Reg rs1, uint32_t f3, Reg rd, uint32_t op) {
+  return (imm_signed(imm, 12) << 20) | (reg(rs1) << 15) | (f3 << 12) | (reg(rd) << 7) | op;
+}
+
+constexpr uint32_t s_type(int32_t imm, Reg rs2, Reg rs1, uint32_t f3) {
+  uint32_t i = imm_signed(imm, 12);
+  return (bits(i, 11, 5) << 25) | (reg(rs2) << 20) | (reg(rs1) << 15) | (f3 << 12) | (bits(i, 4, 0) << 7) | 0x23;
+}
+
+constexpr uint32_t b_imm(int32_t off) {
+  uint32_t i = imm_signed(off, 13);
+  if (off & 1) bad_immediate(off);
+  return (bits(i, 12, 12) << 31) | (bits(i, 10, 5) << 25) | (bits(i, 4, 1) << 8) | (bits(i, 11, 11) << 7);
+}
+
+constexpr uint32_t j_imm(int32_t off) {
+  uint32_t i = imm_signed(off, 21);
+  if (off & 1) bad_immediate(off);
+  return (bits(i, 20, 20) << 31) | (bits(i, 10, 1) << 21) | (bits(i, 11, 11) << 20) | (bits(i, 19, 12) << 12);
+}
+
+constexpr uint32_t cb_imm(int32_t off) {
+  uint32_t i = imm_signed(off, 9);
+  if (off & 1) bad_immediate(off);
+  return (bits(i, 8, 8) << 12) | (bits(i, 4, 3) << 10) | (bits(i, 7, 6) << 5) | (bits(i, 2, 1) << 3) | (bits(i, 5, 5) << 2);
+}
+
+constexpr uint32_t cj_imm(int32_t off) {
+  uint32_t i = imm_signed(off, 12);
+  if (off & 1) bad_immediate(off);
+  return (bits(i, 11, 11) << 12) | (bits(i, 4, 4) << 11) | (bits(i, 9, 8) << 9) | (bits(i, 10, 10) << 8) |
+         (bits(i, 6, 6) << 7) | (bits(i, 7, 7) << 6) | (bits(i, 3, 1) << 3) | (bits(i, 5, 5) << 2);
+}
+
+//------------------------------------------------------------------------------
+// RV32E
+
+constexpr Insn lui  (Reg rd, uint32_t imm20)         { return op32((imm_unsigned(imm20, 20) << 12) | (reg(rd) << 7) | 0x37); }
+constexpr Insn addi (Reg rd, Reg rs1, int32_t imm)   { return op32(i_type(imm, rs1, 0, rd, 0x13)); }
+constexpr Insn xori (Reg rd, Reg rs1, int32_t imm)   { return op32(i_type(imm, rs1, 4, rd, 0x13)); }
+constexpr Insn ori  (Reg rd, Reg rs1, int32_t imm)   { return op32(i_type(imm, rs1, 6, rd, 0x13)); }
+constexpr Insn andi (Reg rd, Reg rs1, int32_t imm)   { return op32(i_type(imm, rs1, 7, rd, 0x13)); }
+constexpr Insn slli (Reg rd, Reg rs1, int32_t shamt) { return op32(i_type(imm_unsigned(shamt, 5), rs1, 1, rd, 0x13)); }
+constexpr Insn srli (Reg rd, Reg rs1, int32_t shamt) { return op32(i_type(imm_unsigned(shamt, 5), rs1, 5, rd, 0x13)); }
+constexpr Insn srai (Reg rd, Reg rs1, int32_t shamt) { return op32(i_type(0x400 | imm_unsigned(shamt, 5), rs1, 5, rd, 0x13)); }
+
+constexpr Insn add  (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x00, rs2, rs1, 0, rd, 0x33)); }
+constexpr Insn sub  (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x20, rs2, rs1, 0, rd, 0x33)); }
+constexpr Insn xor_ (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x00, rs2, rs1, 4, rd, 0x33)); }
+constexpr Insn or_  (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x00, rs2, rs1, 6, rd, 0x33)); }
+constexpr Insn and_ (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x00, rs2, rs1, 7, rd, 0x33)); }
+constexpr Insn sltu (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x00, rs2, rs1, 3, rd, 0x33)); }
+constexpr Insn srl  (Reg rd, Reg rs1, Reg rs2) { return op32(r_type(0x00, rs2, rs1, 5, rd, 0x33)); }
+
+constexpr Insn lb   (Reg rd, int32_t off, Reg rs1)  { return op32(i_type(off, rs1, 0, rd, 0x03)); }
+constexpr Insn lh   (Reg rd, int32_t off, Reg rs1)  { return op32(i_type(off, rs1, 1, rd, 0x03)); }
+constexpr Insn lw   (Reg rd, int32_t off, Reg rs1)  { return op32(i_type(off, rs1, 2, rd, 0x03)); }
+constexpr Insn lbu  (Reg rd, int32_t off, Reg rs1)  { return op32(i_type(off, rs1, 4, rd, 0x03)); }
+constexpr Insn lhu  (Reg rd, int32_t off, Reg rs1)  { return op32(i_type(off, rs1, 5, rd, 0x03)); }
+constexpr Insn sb   (Reg rs2, int32_t off, Reg rs1) { return op32(s_type(off, rs2, rs1, 0)); }
+constexpr Insn sh   (Reg rs2, int32_t off, Reg rs1) { return op32(s_type(off, rs2, rs1, 1)); }
+constexpr Insn sw   (Reg rs2, int32_t off, Reg rs1) { return op32(s_type(off, rs2, rs1, 2)); }
+
+constexpr Insn branch(uint32_t f3, Reg rs1, Reg rs2, Label l) {
+  return { (reg(rs2) << 20) | (reg(rs1) << 15) | (f3 << 12) | 0x63, 4, FIX_B, int8_t(l.id) };
+}
+constexpr Insn beq  (Reg rs1, Reg rs2, Label l) { return branch(0, rs1, rs2, l); }
+constexpr Insn bne  (Reg rs1, Reg rs2, Label l) { return branch(1, rs1, rs2, l); }
+constexpr Insn blt  (Reg rs1, Reg rs2, Label l) { return branch(4, rs1, rs2, l); }
+constexpr Insn bge  (Reg rs1, Reg rs2, Label l) { return branch(5, rs1, rs2, l); }
+constexpr Insn bltu (Reg rs1, Reg rs2, Label l) { return branch(6, rs1, rs2, l); }
+constexpr Insn bgeu (Reg rs1, Reg rs2, Label l) { return branch(7, rs1, rs2, l); }
+constexpr Insn jal  (Reg rd, Label l)           { return { (reg(rd) << 7) | 0x6F, 4, FIX_J, int8_t(l.id) }; }
+
+constexpr Insn csrr (Reg rd, uint32_t csr) { return op32((imm_unsigned(csr, 12) << 20) | (2 << 12) | (reg(rd) << 7) | 0x73); }
+constexpr Insn csrw (uint32_t csr, Reg rs) { return op32((imm_unsigned(csr, 12) << 20) | (reg(rs) << 15) | (1 << 12) | 0x73); }
+constexpr Insn ebreak()                    { return op32(0x00100073); }
+
+//------------------------------------------------------------------------------
+// Compressed
+
+constexpr uint32_t cl_imm(int32_t off) {
+  uint32_t i = imm_unsigned(off, 7, 4);
+  return (bits(i, 5, 3) << 10) | (bits(i, 2, 2) << 6) | (bits(i, 6, 6) << 5);
+}
+
+constexpr uint32_t ci_imm(int32_t imm) {
+  uint32_t i = imm_signed(imm, 6);
+  return (bits(i, 5, 5) << 12) | (bits(i, 4, 0) << 2);
+}
+
+constexpr Insn c_lw   (Reg rd, int32_t off, Reg rs1)  { return op16(0x4000 | cl_imm(off) | (creg(rs1) << 7) | (creg(rd) << 2)); }
+constexpr Insn c_sw   (Reg rs2, int32_t off, Reg rs1) { return op16(0xC000 | cl_imm(off) | (creg(rs1) << 7) | (creg(rs2) << 2)); }
+
+constexpr Insn c_nop  ()                     { return op16(0x0001); }
+constexpr Insn c_addi (Reg rd, int32_t imm)  { return op16(0x0001 | ci_imm(imm) | (reg(rd) << 7)); }
+constexpr Insn c_li   (Reg rd, int32_t imm)  { return op16(0x4001 | ci_imm(imm) | (reg(rd) << 7)); }
+constexpr Insn c_srli (Reg rd, int32_t sh)   { return op16(0x8001 | (creg(rd) << 7) | (imm_unsigned(sh, 5) << 2)); }
+constexpr Insn c_andi (Reg rd, int32_t imm)  { return op16(0x8801 | ci_imm(imm) | (creg(rd) << 7)); }
+constexpr Insn c_sub  (Reg rd, Reg rs2)      { return op16(0x8C01 | (creg(rd) << 7) | (creg(rs2) << 2)); }
+constexpr Insn c_xor  (Reg rd, Reg rs2)      { return op16(0x8C21 | (creg(rd) << 7) | (creg(rs2) << 2)); }
+constexpr Insn c_or   (Reg rd, Reg rs2)      { return op16(0x8C41 | (creg(rd) << 7) | (creg(rs2) << 2)); }
+constexpr Insn c_and  (Reg rd, Reg rs2)      { return op16(0x8C61 | (creg(rd) << 7) | (creg(rs2) << 2)); }
+constexpr Insn c_slli (Reg rd, int32_t sh)   { return op16(0x0002 | (reg(rd) << 7) | (imm_unsigned(sh, 5) << 2)); }
+constexpr Insn c_mv   (Reg rd, Reg rs2)      { return op16(0x8002 | (reg(rd) << 7) | (reg(rs2) << 2)); }
+constexpr Insn c_add  (Reg rd, Reg rs2)      { return op16(0x9002 | (reg(rd) << 7) | (reg(rs2) << 2)); }
+constexpr Insn c_ebreak()                    { return op16(0x9002); }
+
+constexpr Insn c_j    (Label l)         { return { 0xA001, 2, FIX_CJ, int8_t(l.id) }; }
+constexpr Insn c_beqz (Reg rs1, Label l) { return { 0xC001 | (creg(rs1) << 7), 2, FIX_CB, int8_t(l.id) }; }
+constexpr Insn c_bnez (Reg rs1, Label l) { return { 0xE001 | (creg(rs1) << 7), 2, FIX_CB, int8_t(l.id) }; }
+
+//------------------------------------------------------------------------------
+
+constexpr int find_label(const Insn* list, int count, int id) {
+  int pc = 0;
+  for (int i = 0; i < count; i++) {
+    if (list[i].fixup == LABEL && list[i].label == id) return pc;
+    pc += list[i].size;
+  }
+  bad_label(id);
+  return 0;
+}
+
+// Lays out 'list' in the progbuf. Also usable at run time for programs that
+// depend on run time values, but then nothing checks the encodings - keep
+// those programs simple and fixed-size.
+constexpr bool is_ebreak(const Insn& insn) {
+  return insn.fixup == NONE && (insn.bits == 0x00100073 || (insn.size == 2 && insn.bits == 0x9002));
+}
+
+constexpr uint32_t fnv1a(uint32_t hash, uint32_t word) {
+  for (int i = 0; i < 4; i++) {
+    hash = (hash ^ ((word >> (i * 8)) & 0xFF)) * 16777619u;
+  }
+  return hash;
+}
+
+constexpr Prog assemble(const Insn* list, int count) {
+  uint16_t half[progbuf_words * 2] = {};
+  int pc = 0;
+  for (int i = 0; i < count; i++) {
+    Insn insn = list[i];
+    if (insn.fixup == LABEL) continue;
+
+    int32_t off = insn.fixup == NONE ? 0 : find_label(list, count, insn.label) - pc;
+    switch (insn.fixup) {
+      case FIX_B:  insn.bits |= b_imm(off);  break;
+      case FIX_J:  insn.bits |= j_imm(off);  break;
+      case FIX_CB: insn.bits |= cb_imm(off); break;
+      case FIX_CJ: insn.bits |= cj_imm(off); break;
+      default: break;
+    }
+
+    half[pc / 2] = uint16_t(insn.bits);
+    if (insn.size == 4) half[pc / 2 + 1] = uint16_t(insn.bits >> 16);
+    pc += insn.size;
+  }
+
+  // Falling off the end (or branching to a trailing label) needs the c.ebreak
+  // the padding puts at pc to be part of the program.
+  int end = pc;
+  if (pc < progbuf_words * 4 && !(count && is_ebreak(list[count - 1]))) end += 2;
+
+  for (; pc < progbuf_words * 4; pc += 2) half[pc / 2] = 0x9002;
+
+  Prog prog = {};
+  prog.size = (end + 3) / 4;
+  prog.hash = fnv1a(2166136261u, prog.size);
+  for (int i = 0; i < progbuf_words; i++) {
+    prog.words[i] = half[i * 2] | (uint32_t(half[i * 2 + 1]) << 16);
+    if (i < prog.size) prog.hash = fnv1a(prog.hash, prog.words[i]);
+  }
+  if (!prog.hash) prog.hash = 1;
+  return prog;
+}
+
+template<Insn... insns>
+constexpr Prog assemble() {
+  static_assert(sizeof...(insns) > 0);
+  static_assert((insns.size + ...) <= progbuf_words * 4, "program doesn't fit in the progbuf");
+
+  constexpr Insn list[] = { insns... };
+  return assemble(list, sizeof...(insns));
+}
+
+//------------------------------------------------------------------------------
+// Splits an address for "lui rd, hi20(addr)" + "lw/sw/addi ..., lo12(addr)"
+
+constexpr uint32_t hi20(uint32_t addr) { return (addr + 0x800) >> 12; }
+constexpr int32_t  lo12(uint32_t addr) { return int32_t(addr << 20) >> 20; }
+
+//------------------------------------------------------------------------------
+// Spot checks against binutils' encodings
+
+static_assert(lui(a0, 0xE0000).bits       == 0xe0000537);
+static_assert(lw(a1, 0x0F8, a0).bits      == 0x0f852583);
+static_assert(sw(a1, 0x0F4, a0).bits      == 0x0eb52a23);
+static_assert(addi(a1, a1, -1).bits       == 0xfff58593);
+static_assert(andi(s0, a2, 63).bits       == 0x03f67413);
+static_assert(csrr(a0, 0x7b0).bits        == 0x7b002573);
+static_assert(srai(a4, a2, 31).bits       == 0x41f65713);
+static_assert(srl(a4, a5, a3).bits        == 0x00d7d733);
+static_assert(c_lw(s0, 0, a1).bits        == 0x4180);
+static_assert(c_sw(a3, 16, a0).bits       == 0xc914);
+static_assert(c_andi(s0, 1).bits          == 0x8805);
+static_assert(c_addi(a1, -1).bits         == 0x15fd);
+static_assert(c_mv(ra, sp).bits           == 0x808a);
+static_assert((hi20(0x4002200C) << 12) + lo12(0x4002200C) == 0x4002200C);
+static_assert((hi20(0x20000FFC) << 12) + lo12(0x20000FFC) == 0x20000FFC);
+static_assert(assemble<ebreak()>().size == 1);
+static_assert(assemble<c_nop(), c_nop()>().size == 2);
+static_assert(assemble<c_nop(), c_ebreak()>().size == 1);
+static_assert(assemble<c_nop()>().hash != assemble<c_nop(), c_nop()>().hash);
+
+} // namespace rvasm
+
+//------------------------------------------------------------------------------
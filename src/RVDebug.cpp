@@ -1,8 +1,12 @@
 #include "RVDebug.h"
 #include <stdio.h>
+#include <string.h>
 
 #include "debug_defines.h"
 #include "utils.h"
+#include "RVAsm.h"
+
+using namespace rvasm;
 
 //------------------------------------------------------------------------------
 
@@ -20,11 +24,42 @@ void RVDebug::init() {
   for (int i = 0; i < 8; i++) {
     prog_cache[i] = 0xDEADBEEF;
   }
+  prog_hash = 0;
+  tail_ebreak = false;
   for (int i = 0; i < 32; i++) {
     reg_cache[i] = 0xDEADBEEF;
   }
   dirty_regs = 0;
   cached_regs = 0;
+  dcsr_cached = false;
+  for (auto& h : hot_addrs) h = {};
+  dmi->invalidate();
+  probe_dm();
+}
+
+//----------------------------------------
+// The spec allows up to 16 progbuf words and 12 data registers, anything
+// outside that means nobody answered and we assume a CH32V003.
+
+void RVDebug::probe_dm() {
+  auto abstractcs = get_abstractcs();
+  auto hartinfo = get_hartinfo();
+
+  progbuf_size = abstractcs.PROGBUFSIZE;
+  data_count = abstractcs.DATACOUNT;
+  data_addr = hartinfo.DATAACCESS ? 0xE0000000 | hartinfo.DATAADDR : 0;
+
+  if (progbuf_size > 16 || data_count > 12 || !data_count) {
+    LOG_R("RVDebug::probe_dm() - Bad ABSTRACTCS 0x%08x, assuming CH32V003\n", uint32_t(abstractcs));
+    progbuf_size = 8;
+    data_count = 2;
+    data_addr = 0xE00000F4;
+  }
+  if (progbuf_size < 2) {
+    LOG_R("RVDebug::probe_dm() - %d progbuf words isn't enough to access memory\n", progbuf_size);
+  }
+
+  small_progs = progbuf_size < 8 || data_count < 2 || data_addr != 0xE00000F4;
 }
 
 //------------------------------------------------------------------------------
@@ -33,9 +68,7 @@ bool RVDebug::halt() {
   LOG("RVDebug::halt()\n");
 
   set_dmcontrol(0x80000001);
-  while(!get_dmstatus().ALLHALTED) {
-    LOG("ALLHALTED not set yet\n");
-  }
+  wait_dmstatus(DM_DMSTATUS_ALLHALTED, DM_DMSTATUS_ALLHALTED);
   set_dmcontrol(0x00000001);
 
   LOG("RVDebug::halt() done\n");
@@ -52,6 +85,7 @@ bool RVDebug::resume() {
     return false;
   }
 
+  set_step(false);
   reload_regs();
   set_dmcontrol(0x40000001);
 
@@ -71,25 +105,46 @@ bool RVDebug::resume() {
 //------------------------------------------------------------------------------
 
 bool RVDebug::step() {
-  LOG("RVDebug::step()\n");
+  return step_n(1);
+}
+
+//----------------------------------------
+// DCSR.STEP stays set until the next resume(), so back-to-back steps are just
+// a resume request and a halt poll each.
+
+bool RVDebug::step_n(int count) {
+  LOG("RVDebug::step_n(%d)\n", count);
 
   if (get_dmstatus().ALLHAVERESET) {
-    LOG("RVDebug::step() - Can't step while in reset!\n");
+    LOG("RVDebug::step_n() - Can't step while in reset!\n");
     return false;
   }
 
-  Csr_DCSR dcsr = get_dcsr();
-  dcsr.STEP = 1;
-  set_dcsr(dcsr);
-  resume();
-  dcsr.STEP = 0;
-  set_dcsr(dcsr);
+  set_step(true);
+  reload_regs();
 
-  LOG("RVDebug::step() done\n");
+  for (int i = 0; i < count; i++) {
+    set_dmcontrol(0x40000001);
+    set_dmcontrol(0x00000001);
+    wait_dmstatus(DM_DMSTATUS_ALLHALTED, DM_DMSTATUS_ALLHALTED);
+  }
+  cached_regs = 0;
+
+  LOG("RVDebug::step_n() done\n");
 
   return true;
 }
 
+//----------------------------------------
+
+void RVDebug::set_step(bool step) {
+  Csr_DCSR dcsr = get_dcsr();
+  if (dcsr.STEP != step) {
+    dcsr.STEP = step;
+    set_dcsr(dcsr);
+  }
+}
+
 //------------------------------------------------------------------------------
 
 bool RVDebug::reset() {
@@ -97,28 +152,20 @@ bool RVDebug::reset() {
 
   // Halt and leave halt request set
   set_dmcontrol(0x80000001);
-  while (!get_dmstatus().ALLHALTED) {
-    LOG("ALLHALTED not set yet 1\n");
-  }
+  wait_dmstatus(DM_DMSTATUS_ALLHALTED, DM_DMSTATUS_ALLHALTED);
 
   // Set reset request
   set_dmcontrol(0x80000003);
-  while (!get_dmstatus().ALLHAVERESET) {
-    LOG("ALLHAVERESET not set yet\n");
-  }
+  wait_dmstatus(DM_DMSTATUS_ALLHAVERESET, DM_DMSTATUS_ALLHAVERESET);
 
   // Clear reset request and hold halt request
   set_dmcontrol(0x80000001);
   // this busywait seems to be required or we hang
-  while (!get_dmstatus().ALLHALTED) {
-    LOG("ALLHALTED not set yet 2\n");
-  }
+  wait_dmstatus(DM_DMSTATUS_ALLHALTED, DM_DMSTATUS_ALLHALTED);
 
   // Clear HAVERESET
   set_dmcontrol(0x90000001);
-  while (get_dmstatus().ALLHAVERESET) {
-    LOG("ALLHAVERESET not cleared yet\n");
-  }
+  wait_dmstatus(DM_DMSTATUS_ALLHAVERESET, 0);
 
   // Clear halt request
   set_dmcontrol(0x00000001);
@@ -154,23 +201,42 @@ bool RVDebug::enable_breakpoints() {
 
 //------------------------------------------------------------------------------
 
-void RVDebug::load_prog(const char *name, uint32_t *prog, uint32_t clobber) {
-  //LOG("RVDebug::load_prog(%s, 0x%08x, 0x%08x)\n", name, prog, clobber);
-
-  // Upload any PROG{N} word that changed.
-  for (int i = 0; i < 8; i++) {
-    if (prog_cache[i] != prog[i]) {
-      dmi->put(DM_PROGBUF0 + i, prog[i]);
-      prog_cache[i] = prog[i];
+void RVDebug::load_prog([[maybe_unused]] const char *name, const Prog& prog, uint32_t clobber) {
+  //LOG("RVDebug::load_prog(%s, 0x%08x, 0x%08x)\n", name, prog.hash, clobber);
+
+  // Upload any PROG{N} word that changed. Words past prog.size never run, so
+  // they keep whatever the last program left there.
+  int uploaded = 0;
+  if (prog.hash != prog_hash) {
+    for (int i = 0; i < prog.size; i++) {
+      if (prog_cache[i] != prog[i]) {
+        dmi->put(DM_PROGBUF0 + i, prog[i]);
+        prog_cache[i] = prog[i];
+        uploaded++;
+      }
     }
+    prog_hash = prog.hash;
+  }
+
+  // Full-size programs can end by running off PROGBUF7 and rely on the
+  // CH32V003's implicit ebreak there. Bigger progbufs get a real one.
+  if (prog.size == progbuf_words && progbuf_size > progbuf_words && !tail_ebreak) {
+    dmi->put(DM_PROGBUF0 + progbuf_words, ebreak().bits);
+    tail_ebreak = true;
+    uploaded++;
+  }
+
+  for (int i = 0; i < prog.size; i++) {
+    CHECK(prog_cache[i] == prog[i], "RVDebug::load_prog() - %s collides with the resident program\n", name);
   }
+  if (stats) stats->on_prog_load(uploaded);
 
   // Save any registers this program is going to clobber.
   for (int i = 0; i < reg_count; i++) {
     if (bit(clobber, i)) {
       if (!bit(cached_regs, i)) {
         if (!bit(dirty_regs, i)) {
-          reg_cache[i] = get_gpr(i);
+          reg_cache[i] = fetch_gpr(i);
           cached_regs |= (1 << i);
         }
         else {
@@ -198,9 +264,7 @@ void RVDebug::run_prog(bool wait_until_not_busy) {
   set_command(cmd);
 
   if (wait_until_not_busy) {
-    while (get_abstractcs().BUSY) {
-      //LOG("get_abstractcs().BUSY not cleared yet\n");
-    }
+    wait_not_busy();
   }
   else {
     // It takes 40 usec to do _anything_ over the debug interface, so if the
@@ -227,6 +291,22 @@ Reg_HARTINFO RVDebug::get_hartinfo() { return dmi->get(DM_HARTINFO); }
 
 Reg_ABSTRACTCS RVDebug::get_abstractcs() { return dmi->get(DM_ABSTRACTCS); }
 
+Reg_DMSTATUS RVDebug::wait_dmstatus(uint32_t mask, uint32_t expect) {
+  uint32_t status;
+  do {
+    status = dmi->poll(DM_DMSTATUS, mask, expect, poll_iters, nullptr);
+  } while ((status & mask) != expect);
+  return status;
+}
+
+Reg_ABSTRACTCS RVDebug::wait_not_busy() {
+  uint32_t abstractcs;
+  do {
+    abstractcs = dmi->poll(DM_ABSTRACTCS, DM_ABSTRACTCS_BUSY, 0, poll_iters, nullptr);
+  } while (abstractcs & DM_ABSTRACTCS_BUSY);
+  return abstractcs;
+}
+
 Reg_COMMAND RVDebug::get_command() { return dmi->get(DM_COMMAND); }
 
 Reg_ABSTRACTAUTO RVDebug::get_abstractauto() {
@@ -263,32 +343,135 @@ void RVDebug::set_abstractauto(Reg_ABSTRACTAUTO r) {
 
 //------------------------------------------------------------------------------
 
-Csr_DCSR RVDebug::get_dcsr() { return get_csr(CSR_DCSR); }
+// We're the only one writing DCSR's control bits, so those come from the
+// cache. CAUSE is only as fresh as the last get_csr(CSR_DCSR).
+Csr_DCSR RVDebug::get_dcsr() {
+  if (!dcsr_cached) get_csr(CSR_DCSR);
+  return dcsr_cache;
+}
 
-uint32_t RVDebug::get_dpc() { return get_csr(CSR_DPC); }
+uint32_t RVDebug::get_dpc() { return get_gpr(16); }
 
 uint32_t RVDebug::get_dscratch0() { return get_csr(CSR_DSCRATCH0); }
 
 uint32_t RVDebug::get_dscratch1() { return get_csr(CSR_DSCRATCH1); }
 
-void RVDebug::set_dcsr(Csr_DCSR r) { set_csr(CSR_DCSR, r); }
+void RVDebug::set_dcsr(Csr_DCSR r) {
+  if (!dcsr_cached || uint32_t(r) != uint32_t(dcsr_cache)) set_csr(CSR_DCSR, r);
+}
 
-void RVDebug::set_dpc(uint32_t r) { set_csr(CSR_DPC, r); }
+void RVDebug::set_dpc(uint32_t r) { set_gpr(16, r); }
 
 void RVDebug::set_dscratch0(uint32_t r) { set_csr(CSR_DSCRATCH0, r); }
 
 void RVDebug::set_dscratch1(uint32_t r) { set_csr(CSR_DSCRATCH1, r); }
 
 //------------------------------------------------------------------------------
-// Getting multiple GPRs via autoexec is not supported on CH32V003 :/
+// CH32V003 doesn't support AARPOSTINCREMENT, so single registers take a
+// COMMAND write and a DATA0 read each. get_gprs() streams them instead.
 
 uint32_t RVDebug::get_gpr(int index) {
-  if (index == 16) {
-    return get_dpc();
+  if (!bit(cached_regs, index)) {
+    reg_cache[index] = fetch_gpr(index);
+    cached_regs |= (1 << index);
+  }
+  return reg_cache[index];
+}
+
+void RVDebug::set_gpr(int index, uint32_t gpr) {
+  reg_cache[index] = gpr;
+  cached_regs |= (1 << index);
+  dirty_regs |= (1 << index);
+}
+
+void RVDebug::set_prog_arg(int index, uint32_t data) {
+  CHECK(bit(prog_will_clobber, index), "RVDebug::set_prog_arg() - reg %d is not clobbered by the program", index);
+  CHECK(bit(cached_regs, index));
+  store_gpr(index, data);
+  dirty_regs |= (1 << index);
+}
+
+//------------------------------------------------------------------------------
+// There's no bulk read to go with store_gprs_bulk(). Without
+// AARPOSTINCREMENT the only way to stream registers out is to shift them
+// through x1, and putting x1-x14 back on resume costs more than the 12 frames
+// that saves.
+
+void RVDebug::get_gprs(uint32_t* regs) {
+  regs[0] = 0;
+  for (int i = 1; i < reg_count; i++) regs[i] = get_gpr(i);
+  regs[reg_count] = get_dpc();
+}
+
+void RVDebug::set_gprs(const uint32_t* regs) {
+  for (int i = 1; i < reg_count; i++) set_gpr(i, regs[i]);
+  set_dpc(regs[reg_count]);
+}
+
+//----------------------------------------
+// Streams the registers in 'mask' back through DATA0 with ABSTRACTAUTO. The
+// command writes the highest one and the program shifts each register in the
+// set down to the next lower one, so the values go in lowest first and the
+// last one skips the shift.
+static constexpr Prog prog_shift_down(uint32_t mask) {
+  Insn prog[15] = {};
+  int count = 0;
+  int prev = 0;
+  for (int i = 1; i < 16; i++) {
+    if (!((mask >> i) & 1)) continue;
+    if (prev) prog[count++] = c_mv(Reg(prev), Reg(i));
+    prev = i;
+  }
+  return assemble(prog, count);
+}
+
+void RVDebug::store_gprs_bulk(uint32_t mask) {
+  int regs[15];
+  int count = 0;
+  for (int i = 1; i < 16; i++) {
+    if (bit(mask, i)) regs[count++] = i;
   }
+  CHECK(count >= 2);
+
+  load_prog("shift_down", prog_shift_down(mask), 0);
 
   Reg_COMMAND cmd;
-  cmd.REGNO = 0x1000 | index;
+  cmd.REGNO = 0x1000 | regs[count - 1];
+  cmd.WRITE = 1;
+  cmd.TRANSFER = 1;
+  cmd.POSTEXEC = 1;
+  cmd.AARSIZE = 2;
+
+  DmiBatch batch(dmi, nullptr);
+  batch.put(DM_DATA0, reg_cache[regs[0]]);
+  batch.put(DM_COMMAND, cmd);
+  batch.put(DM_ABSTRACTAUTO, 0x00000001);
+  for (int i = 1; i < count - 1; i++) batch.put(DM_DATA0, reg_cache[regs[i]]);
+  batch.put(DM_ABSTRACTAUTO, 0x00000000);
+  cmd.POSTEXEC = 0;
+  batch.put(DM_DATA0, reg_cache[regs[count - 1]]);
+  batch.put(DM_COMMAND, cmd);
+  batch.flush();
+
+  dirty_regs &= ~mask;
+}
+
+//------------------------------------------------------------------------------
+
+int RVDebug::prog_upload_cost(const Prog& prog) {
+  if (prog.hash == prog_hash) return 0;
+  int cost = 0;
+  for (int i = 0; i < prog.size; i++) {
+    if (prog_cache[i] != prog[i]) cost++;
+  }
+  return cost;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t RVDebug::fetch_gpr(int index) {
+  Reg_COMMAND cmd;
+  cmd.REGNO = index == 16 ? CSR_DPC : 0x1000 | index;
   cmd.TRANSFER = 1;
   cmd.AARSIZE = 2;
   set_command(cmd);
@@ -298,20 +481,15 @@ uint32_t RVDebug::get_gpr(int index) {
 
 //------------------------------------------------------------------------------
 
-void RVDebug::set_gpr(int index, uint32_t gpr) {
-  if (index == 16) {
-    set_dpc(gpr);
-    return;
-  } else {
-    Reg_COMMAND cmd;
-    cmd.REGNO = 0x1000 | index;
-    cmd.WRITE = 1;
-    cmd.TRANSFER = 1;
-    cmd.AARSIZE = 2;
+void RVDebug::store_gpr(int index, uint32_t gpr) {
+  Reg_COMMAND cmd;
+  cmd.REGNO = index == 16 ? CSR_DPC : 0x1000 | index;
+  cmd.WRITE = 1;
+  cmd.TRANSFER = 1;
+  cmd.AARSIZE = 2;
 
-    set_data0(gpr);
-    set_command(cmd);
-  }
+  set_data0(gpr);
+  set_command(cmd);
 }
 
 //------------------------------------------------------------------------------
@@ -319,11 +497,23 @@ void RVDebug::set_gpr(int index, uint32_t gpr) {
 void RVDebug::reload_regs() {
   LOG("RVDebug::reload_regs()\n");
 
-  for (int i = 0; i < reg_count; i++) {
+  // Put the dirty x1-x15 back in one stream if that's cheaper than one at a
+  // time - the stream costs 4 frames plus one per register plus whatever part
+  // of the program isn't loaded, single stores cost 2 frames per register.
+  uint32_t mask = dirty_regs & cached_regs & 0xFFFE;
+  int dirty = __builtin_popcount(mask);
+  if (dirty >= 2) {
+    Prog prog = prog_shift_down(mask);
+    if (fits(prog) && dirty * 2 > dirty + 4 + prog_upload_cost(prog)) {
+      store_gprs_bulk(mask);
+    }
+  }
+
+  for (int i = 0; i <= 16; i++) {
     if (dirty_regs & (1 << i)) {
       if (cached_regs & (1 << i)) {
         LOG("  Reloading reg %02d\n", i);
-        set_gpr(i, reg_cache[i]);
+        store_gpr(i, reg_cache[i]);
       } else {
         CHECK(false, "GPR %d is dirity and we dont' have a saved copy!\n", i);
       }
@@ -337,18 +527,31 @@ void RVDebug::reload_regs() {
 //------------------------------------------------------------------------------
 
 uint32_t RVDebug::get_csr(int index) {
+  if (index == CSR_DPC) return get_gpr(16);
+
   Reg_COMMAND cmd;
   cmd.REGNO = index;
   cmd.TRANSFER = 1;
   cmd.AARSIZE = 2;
 
   set_command(cmd);
-  return get_data0();
+  uint32_t data = get_data0();
+
+  if (index == CSR_DCSR) {
+    dcsr_cache = data;
+    dcsr_cached = true;
+  }
+  return data;
 }
 
 //------------------------------------------------------------------------------
 
 void RVDebug::set_csr(int index, uint32_t data) {
+  if (index == CSR_DPC) {
+    set_gpr(16, data);
+    return;
+  }
+
   Reg_COMMAND cmd;
   cmd.REGNO = index;
   cmd.WRITE = 1;
@@ -357,6 +560,11 @@ void RVDebug::set_csr(int index, uint32_t data) {
 
   set_data0(data);
   set_command(cmd);
+
+  if (index == CSR_DCSR) {
+    dcsr_cache = data;
+    dcsr_cached = true;
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -368,6 +576,18 @@ bool RVDebug::clear_err() {
   return true;
 }
 
+//----------------------------------------
+// The batched block transfers don't look at ABSTRACTCS between words, so they
+// check it once at the end. A command error is left set for the caller.
+
+void RVDebug::check_block_status(const char* name) {
+  auto abstractcs = get_abstractcs();
+  CHECK(!abstractcs.BUSY);
+  if (abstractcs.CMDER) {
+    LOG_R("RVDebug::%s() - CMDER %d\n", name, abstractcs.CMDER);
+  }
+}
+
 //------------------------------------------------------------------------------
 
 bool RVDebug::sanity() {
@@ -537,32 +757,73 @@ void RVDebug::set_mem_u8(uint32_t addr, uint8_t data) {
 // data1 = address. set low bit if this is a write
 // only clobbers A0/A1
 
-static uint16_t prog_get_set_u32[16] = {
-  //0xe0000537,   // lui a0,0xe0000
-  0x0537,
-  0xe000,
-
-  //0x0f450513,   // addi a0,a0,0xF4
-  0x0513,
-  0x0f45,
-
-  0x414c,         // lw a1,4(a0)
-  0x8985,         // andi a1,a1,1
-  0xc591,         // beqz a1,get_u32
-
-  //set_u32:
-  0x414c,         // lw a1,4(a0)
-  0x15fd,        	// addi a1,a1,-1
-  0x4108,         // lw a0,0(a0)
-  0xc188,         // sw a0,0(a1)
-  0x9002,         // ebreak
-
-  //get_u32:
-  0x414c,         // lw a1,4(a0)
-  0x418c,         // lw a1,0(a1)
-  0xc10c,         // sw a1,0(a0)
-  0x9002,         // ebreak
-};
+static constexpr Prog prog_get_set_u32 = assemble<
+  lui(a0, 0xE0000),
+  addi(a0, a0, 0xF4),
+  c_lw(a1, 4, a0),
+  c_andi(a1, 1),
+  c_beqz(a1, L(0)),
+
+  // set_u32
+  c_lw(a1, 4, a0),
+  c_addi(a1, -1),
+  c_lw(a0, 0, a0),
+  c_sw(a0, 0, a1),
+  c_ebreak(),
+
+  // get_u32
+  label(0),
+  c_lw(a1, 4, a0),
+  c_lw(a1, 0, a1),
+  c_sw(a1, 0, a0),
+  c_ebreak()
+>();
+
+//------------------------------------------------------------------------------
+// Same as prog_get_set_u32, but with the address baked in so it doesn't have
+// to go through DATA1. Used for addresses we keep coming back to.
+//
+// Both start with the same two words and end in the same ebreak, so switching
+// between reading and writing one address only uploads the two in between.
+
+static Prog prog_get_u32_at(uint32_t addr) {
+  const Insn prog[] = {
+    lui(a0, 0xE0000),
+    lui(a1, hi20(addr)),
+    lw(a1, lo12(addr), a1),
+    sw(a1, 0x0F4, a0),
+    ebreak(),
+  };
+  return assemble(prog, 5);
+}
+
+static Prog prog_set_u32_at(uint32_t addr) {
+  const Insn prog[] = {
+    lui(a0, 0xE0000),
+    lui(a1, hi20(addr)),
+    lw(a0, 0x0F4, a0),
+    sw(a0, lo12(addr), a1),
+    ebreak(),
+  };
+  return assemble(prog, 5);
+}
+
+// Counts accesses per address and says whether this one has been used often
+// enough to be worth its own program. Misses replace the least used entry.
+bool RVDebug::is_hot(uint32_t addr, bool write) {
+  HotAddr* coldest = &hot_addrs[0];
+  for (auto& h : hot_addrs) {
+    if (h.hits && h.addr == addr && h.write == write) {
+      if (h.hits < 255) h.hits++;
+      return h.hits >= hot_threshold;
+    }
+    if (h.hits < coldest->hits) coldest = &h;
+  }
+  *coldest = { addr, 1, write };
+  return false;
+}
+
+//------------------------------------------------------------------------------
 
 uint32_t RVDebug::get_mem_u32_aligned(uint32_t addr) {
   if (addr & 3) {
@@ -570,7 +831,15 @@ uint32_t RVDebug::get_mem_u32_aligned(uint32_t addr) {
     return 0;
   }
 
-  load_prog("prog_get_set_u32", (uint32_t*)prog_get_set_u32, BIT_A0 | BIT_A1);
+  if (small_progs) return get_mem_u32_small(addr);
+
+  if (is_hot(addr, false)) {
+    load_prog("get_u32_at", prog_get_u32_at(addr), BIT_A0 | BIT_A1);
+    run_prog_fast();
+    return get_data0();
+  }
+
+  load_prog("prog_get_set_u32", prog_get_set_u32, BIT_A0 | BIT_A1);
   set_data1(addr);
   run_prog_fast();
   auto result = get_data0();
@@ -586,7 +855,19 @@ void RVDebug::set_mem_u32_aligned(uint32_t addr, uint32_t data) {
     return;
   }
 
-  load_prog("prog_get_set_u32", (uint32_t*)prog_get_set_u32, BIT_A0 | BIT_A1);
+  if (small_progs) {
+    set_mem_u32_small(addr, data);
+    return;
+  }
+
+  if (is_hot(addr, true)) {
+    load_prog("set_u32_at", prog_set_u32_at(addr), BIT_A0 | BIT_A1);
+    set_data0(data);
+    run_prog_fast();
+    return;
+  }
+
+  load_prog("prog_get_set_u32", prog_get_set_u32, BIT_A0 | BIT_A1);
 
   set_data0(data);
   set_data1(addr | 1);
@@ -599,33 +880,46 @@ void RVDebug::get_block_aligned(uint32_t addr, void *dst, int size_bytes) {
   CHECK((addr & 3) == 0, "RVDebug::get_block_aligned() bad address");
   CHECK((size_bytes & 3) == 0, "RVDebug::get_block_aligned() bad size");
 
-  static uint32_t prog_get_block_aligned[8] = {
-      0xe0000537, // lui    a0, 0xE0000
-      0x0f852583, // lw     a1, 0x0F8(a0)
-      0x0005a583, // lw     a1, 0x000(a1)
-      0x0eb52a23, // sw     a1, 0x0F4(a0)
-      0x0f852583, // lw     a1, 0x0F8(a0)
-      0x00458593, // addi   a1, a1, 4
-      0x0eb52c23, // sw     a1, 0x0F8(a0)
-      0x00100073, // ebreak
-  };
+  if (small_progs) {
+    get_block_small(addr, (uint32_t*)dst, size_bytes / 4);
+    return;
+  }
+
+  static constexpr Prog prog_get_block_aligned = assemble<
+    lui(a0, 0xE0000),
+    lw(a1, 0x0F8, a0),
+    lw(a1, 0x000, a1),
+    sw(a1, 0x0F4, a0),
+    lw(a1, 0x0F8, a0),
+    addi(a1, a1, 4),
+    sw(a1, 0x0F8, a0),
+    ebreak()
+  >();
 
   load_prog("get_block_aligned", prog_get_block_aligned, BIT_A0 | BIT_A1);
-  set_data1(addr);
 
   int size_dwords = size_bytes / 4;
-  uint32_t *cursor = (uint32_t *)dst;
+  if (!size_dwords) return;
 
-  for (int i = 0; i < size_dwords; i++) {
-    if (i == 0) {
-      run_prog_fast();
-      set_abstractauto(0x00000001);
-    }
-    if (i == size_dwords - 1) {
-      set_abstractauto(0x00000000);
-    }
-    cursor[i] = get_data0();
+  // DATA0 reads retrigger the program via ABSTRACTAUTO, so the body of the
+  // transfer is one repeated read that the bus can send as a single block. We
+  // turn autoexec off before the last read so we don't read past the end.
+  Reg_COMMAND cmd;
+  cmd.POSTEXEC = 1;
+
+  DmiBatch batch(dmi, (uint32_t*)dst);
+  batch.put(DM_DATA1, addr);
+  batch.put(DM_COMMAND, cmd);
+  if (size_dwords > 1) {
+    batch.put(DM_ABSTRACTAUTO, 0x00000001);
+    batch.get_repeat(DM_DATA0, size_dwords - 1);
+    batch.put(DM_ABSTRACTAUTO, 0x00000000);
   }
+  batch.get(DM_DATA0);
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+  check_block_status("get_block_aligned");
 }
 
 //------------------------------------------------------------------------------
@@ -634,33 +928,487 @@ void RVDebug::set_block_aligned(uint32_t addr, void *src, int size_bytes) {
   CHECK((addr & 3) == 0);
   CHECK((size_bytes & 3) == 0);
 
-  static uint32_t prog_set_block_aligned[8] = {
-      0xe0000537, // lui    a0, 0xE0000
-      0x0f852583, // lw     a1, 0x0F8(a0)
-      0x0f452503, // lw     a0, 0x0F4(a0)
-      0x00a5a023, // sw     a0, a1
-      0x00458593, // addi   a1, a1, 4
-      0xe0000537, // lui    a0, 0xE0000
-      0x0eb52c23, // sw     a1, 0xF8(a0)
-      0x00100073, // ebreak
-  };
+  if (small_progs) {
+    set_block_small(addr, (uint32_t*)src, size_bytes / 4);
+    return;
+  }
+
+  if (size_bytes == 8) {
+    set_mem_u32_pair(addr, (uint32_t*)src);
+    return;
+  }
+
+  static constexpr Prog prog_set_block_aligned = assemble<
+    lui(a0, 0xE0000),
+    lw(a1, 0x0F8, a0),
+    lw(a0, 0x0F4, a0),
+    sw(a0, 0x000, a1),
+    addi(a1, a1, 4),
+    lui(a0, 0xE0000),
+    sw(a1, 0x0F8, a0),
+    ebreak()
+  >();
 
   load_prog("set_block_aligned", prog_set_block_aligned, BIT_A0 | BIT_A1);
-  set_data1(addr);
 
   int size_dwords = size_bytes / 4;
+  if (!size_dwords) return;
   uint32_t *cursor = (uint32_t *)src;
 
-  for (int i = 0; i < size_dwords; i++) {
-    set_data0(*cursor++);
-    if (i == 0) {
-      run_prog_fast();
-      set_abstractauto(0x00000001);
+  // Same as above, DATA0 writes retrigger the program after the first one.
+  Reg_COMMAND cmd;
+  cmd.POSTEXEC = 1;
+
+  DmiBatch batch(dmi, nullptr);
+  batch.put(DM_DATA1, addr);
+  batch.put(DM_DATA0, cursor[0]);
+  batch.put(DM_COMMAND, cmd);
+  if (size_dwords > 1) {
+    batch.put(DM_ABSTRACTAUTO, 0x00000001);
+    for (int i = 1; i < size_dwords; i++) batch.put(DM_DATA0, cursor[i]);
+    batch.put(DM_ABSTRACTAUTO, 0x00000000);
+  }
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+  check_block_status("set_block_aligned");
+}
+
+//------------------------------------------------------------------------------
+// Two words in one program run - the address goes in A1 and the data comes in
+// through DATA0 and DATA1. That's a frame less than the block program for an
+// unaligned GDB write straddling two words, but longer blocks pay a frame
+// more, so set_block_aligned() only takes it for exactly two.
+
+void RVDebug::set_mem_u32_pair(uint32_t addr, uint32_t* src) {
+  static constexpr Prog prog_set_mem_u32_pair = assemble<
+    lui(a0, 0xE0000),
+    lw(a2, 0x0F4, a0),
+    sw(a2, 0x000, a1),
+    lw(a2, 0x0F8, a0),
+    sw(a2, 0x004, a1),
+    ebreak()
+  >();
+
+  load_prog("set_mem_u32_pair", prog_set_mem_u32_pair, BIT_A0 | BIT_A1 | BIT_A2);
+  set_prog_arg(11, addr);
+
+  Reg_COMMAND cmd;
+  cmd.POSTEXEC = 1;
+
+  DmiBatch batch(dmi, nullptr);
+  batch.put(DM_DATA0, src[0]);
+  batch.put(DM_DATA1, src[1]);
+  batch.put(DM_COMMAND, cmd);
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+  check_block_status("set_mem_u32_pair");
+}
+
+//------------------------------------------------------------------------------
+// One-word programs for debug modules the programs above don't run on - fewer
+// progbuf words, a single data register, or DATA0 not in the hart's address
+// space. The address lives in A1 and the data moves through A2 with abstract
+// register transfers, so all they need is DATA0 and two progbuf words.
+
+static constexpr Prog prog_load_word  = assemble<c_lw(a2, 0, a1)>();
+static constexpr Prog prog_store_word = assemble<c_sw(a2, 0, a1)>();
+static constexpr Prog prog_load_next  = assemble<c_lw(a2, 0, a1), c_addi(a1, 4)>();
+static constexpr Prog prog_store_next = assemble<c_sw(a2, 0, a1), c_addi(a1, 4)>();
+
+static Reg_COMMAND gpr_command(int index, bool write, bool postexec) {
+  Reg_COMMAND cmd;
+  cmd.REGNO = 0x1000 | index;
+  cmd.WRITE = write;
+  cmd.TRANSFER = 1;
+  cmd.POSTEXEC = postexec;
+  cmd.AARSIZE = 2;
+  return cmd;
+}
+
+uint32_t RVDebug::get_mem_u32_small(uint32_t addr) {
+  load_prog("load_word", prog_load_word, BIT_A1 | BIT_A2);
+
+  uint32_t result = 0;
+  DmiBatch batch(dmi, &result);
+  batch.put(DM_DATA0, addr);
+  batch.put(DM_COMMAND, gpr_command(11, true, true));
+  batch.put(DM_COMMAND, gpr_command(12, false, false));
+  batch.get(DM_DATA0);
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+  return result;
+}
+
+void RVDebug::set_mem_u32_small(uint32_t addr, uint32_t data) {
+  load_prog("store_word", prog_store_word, BIT_A1 | BIT_A2);
+
+  DmiBatch batch(dmi, nullptr);
+  batch.put(DM_DATA0, addr);
+  batch.put(DM_COMMAND, gpr_command(11, true, false));
+  batch.put(DM_DATA0, data);
+  batch.put(DM_COMMAND, gpr_command(12, true, true));
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+}
+
+// The transfer runs before the program, so the read command hands over the
+// word loaded by the previous run. Setting A1 primes the first load, and the
+// last word is collected without rerunning so we never read past the end.
+void RVDebug::get_block_small(uint32_t addr, uint32_t* dst, int size_dwords) {
+  if (!size_dwords) return;
+  load_prog("load_next", prog_load_next, BIT_A1 | BIT_A2);
+
+  DmiBatch batch(dmi, dst);
+  batch.put(DM_DATA0, addr);
+  batch.put(DM_COMMAND, gpr_command(11, true, true));
+  if (size_dwords > 1) {
+    batch.put(DM_COMMAND, gpr_command(12, false, true));
+    if (size_dwords > 2) {
+      batch.put(DM_ABSTRACTAUTO, 0x00000001);
+      batch.get_repeat(DM_DATA0, size_dwords - 2);
+      batch.put(DM_ABSTRACTAUTO, 0x00000000);
+    }
+    batch.get(DM_DATA0);
+  }
+  batch.put(DM_COMMAND, gpr_command(12, false, false));
+  batch.get(DM_DATA0);
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+}
+
+void RVDebug::set_block_small(uint32_t addr, const uint32_t* src, int size_dwords) {
+  if (!size_dwords) return;
+  load_prog("store_next", prog_store_next, BIT_A1 | BIT_A2);
+
+  DmiBatch batch(dmi, nullptr);
+  batch.put(DM_DATA0, addr);
+  batch.put(DM_COMMAND, gpr_command(11, true, false));
+  batch.put(DM_DATA0, src[0]);
+  batch.put(DM_COMMAND, gpr_command(12, true, true));
+  if (size_dwords > 1) {
+    batch.put(DM_ABSTRACTAUTO, 0x00000001);
+    for (int i = 1; i < size_dwords; i++) batch.put(DM_DATA0, src[i]);
+    batch.put(DM_ABSTRACTAUTO, 0x00000000);
+  }
+  batch.flush();
+
+  dirty_regs |= prog_will_clobber;
+}
+
+//------------------------------------------------------------------------------
+// Reads the whole words covering the range and keeps the bytes we want.
+
+void RVDebug::get_block_unaligned(uint32_t addr, void *dst, int size_bytes) {
+  uint8_t* cursor = (uint8_t*)dst;
+  uint32_t buf[64];
+
+  while (size_bytes > 0) {
+    int offset = addr & 3;
+    int chunk = size_bytes;
+    if (chunk > int(sizeof(buf)) - offset) chunk = sizeof(buf) - offset;
+    int words = (offset + chunk + 3) / 4;
+
+    get_block_aligned(addr & ~3, buf, words * 4);
+    memcpy(cursor, (uint8_t*)buf + offset, chunk);
+
+    addr += chunk;
+    cursor += chunk;
+    size_bytes -= chunk;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Partial head and tail words are read first so their other bytes survive,
+// then the whole covered range goes out as one aligned stream.
+
+void RVDebug::set_block_unaligned(uint32_t addr, void *src, int size_bytes) {
+  uint8_t* cursor = (uint8_t*)src;
+  uint32_t buf[64];
+
+  while (size_bytes > 0) {
+    int offset = addr & 3;
+    int chunk = size_bytes;
+    if (chunk > int(sizeof(buf)) - offset) chunk = sizeof(buf) - offset;
+    int words = (offset + chunk + 3) / 4;
+    uint32_t base = addr & ~3;
+
+    if (offset) {
+      buf[0] = get_mem_u32_aligned(base);
+    }
+    if (((offset + chunk) & 3) && (words > 1 || !offset)) {
+      buf[words - 1] = get_mem_u32_aligned(base + (words - 1) * 4);
+    }
+    memcpy((uint8_t*)buf + offset, cursor, chunk);
+
+    // A single word doesn't need to switch programs.
+    if (words == 1) {
+      set_mem_u32_aligned(base, buf[0]);
+    }
+    else {
+      set_block_aligned(base, buf, words * 4);
+    }
+
+    addr += chunk;
+    cursor += chunk;
+    size_bytes -= chunk;
+  }
+}
+
+//------------------------------------------------------------------------------
+// memset() done by the target. The whole words go in one run of a loop in the
+// progbuf, the bytes on either side through set_block_unaligned().
+
+void RVDebug::fill_mem(uint32_t addr, uint8_t value, int size) {
+  static constexpr Prog prog_fill_words = assemble<
+    label(0),
+    c_sw(a2, 0, a0),
+    c_addi(a0, 4),
+    bltu(a0, a1, L(0))
+  >();
+
+  if (size <= 0) return;
+
+  uint32_t buf[64];
+  memset(buf, value, sizeof(buf));
+
+  uint32_t begin = (addr + 3) & ~3;
+  uint32_t end = (addr + size) & ~3;
+
+  // Too short for the loop, or no room for it - stream it instead.
+  if (begin >= end || !fits(prog_fill_words)) {
+    while (size > 0) {
+      int chunk = size < int(sizeof(buf)) ? size : int(sizeof(buf));
+      set_block_unaligned(addr, buf, chunk);
+      addr += chunk;
+      size -= chunk;
+    }
+    return;
+  }
+
+  if (begin > addr) set_block_unaligned(addr, buf, begin - addr);
+
+  load_prog("fill_words", prog_fill_words, BIT_A0 | BIT_A1 | BIT_A2);
+  set_prog_arg(10, begin);
+  set_prog_arg(11, end);
+  set_prog_arg(12, buf[0]);
+  run_prog_slow();
+
+  if (addr + size > end) set_block_unaligned(end, buf, addr + size - end);
+}
+
+//------------------------------------------------------------------------------
+// memcpy() done by the target, a word at a time if both ends and the size are
+// aligned and a byte at a time otherwise. Copies forwards, so 'dst' may
+// overlap the range after it but not the range before it.
+
+void RVDebug::copy_mem(uint32_t dst, uint32_t src, int size) {
+  static constexpr Prog prog_copy_words = assemble<
+    label(0),
+    c_lw(a3, 0, a1),
+    c_sw(a3, 0, a0),
+    c_addi(a0, 4),
+    c_addi(a1, 4),
+    bltu(a0, a2, L(0))
+  >();
+
+  static constexpr Prog prog_copy_bytes = assemble<
+    label(0),
+    lbu(a3, 0, a1),
+    sb(a3, 0, a0),
+    c_addi(a0, 1),
+    c_addi(a1, 1),
+    bltu(a0, a2, L(0))
+  >();
+
+  if (size <= 0) return;
+  CHECK(dst <= src || dst >= src + size, "RVDebug::copy_mem() - dst 0x%08x overlaps src 0x%08x\n", dst, src);
+
+  bool words = ((dst | src | size) & 3) == 0;
+  const Prog& prog = words ? prog_copy_words : prog_copy_bytes;
+
+  if (!fits(prog)) {
+    uint32_t buf[64];
+    while (size > 0) {
+      int chunk = size < int(sizeof(buf)) ? size : int(sizeof(buf));
+      get_block_unaligned(src, buf, chunk);
+      set_block_unaligned(dst, buf, chunk);
+      dst += chunk;
+      src += chunk;
+      size -= chunk;
+    }
+    return;
+  }
+
+  load_prog(words ? "copy_words" : "copy_bytes", prog, BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3);
+  set_prog_arg(10, dst);
+  set_prog_arg(11, src);
+  set_prog_arg(12, dst + size);
+  run_prog_slow();
+}
+
+//------------------------------------------------------------------------------
+// GDB's CRC-32 (see update_crc32()) computed by the target a bit at a time,
+// with only the result coming back over the wire. A0 walks the range and A2
+// carries the CRC from one run to the next, so each chunk after the first
+// only needs a new end address in A1. Chunks keep each run to a few ms.
+
+uint32_t RVDebug::crc32(uint32_t addr, int size, uint32_t crc) {
+  static constexpr Prog prog_crc32 = assemble<
+    label(0),
+    lbu(a4, 0, a0),
+    c_slli(a4, 24),
+    c_xor(a2, a4),
+    c_li(a5, 8),
+
+    // crc = (crc << 1) ^ (msb ? poly : 0)
+    label(1),
+    srai(a4, a2, 31),
+    c_and(a4, a3),
+    c_slli(a2, 1),
+    c_xor(a2, a4),
+    c_addi(a5, -1),
+    c_bnez(a5, L(1)),
+
+    c_addi(a0, 1),
+    bltu(a0, a1, L(0))
+  >();
+
+  const int chunk_size = 4096;
+
+  if (size <= 0) return crc;
+
+  if (!fits(prog_crc32)) {
+    uint8_t buf[256];
+    while (size > 0) {
+      int chunk = size < int(sizeof(buf)) ? size : int(sizeof(buf));
+      get_block_unaligned(addr, buf, chunk);
+      crc = update_crc32(crc, buf, chunk);
+      addr += chunk;
+      size -= chunk;
+    }
+    return crc;
+  }
+
+  load_prog("crc32", prog_crc32, BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3 | BIT_A4 | BIT_A5);
+  set_prog_arg(10, addr);
+  set_prog_arg(12, crc);
+  set_prog_arg(13, 0x04C11DB7);
+  while (size > 0) {
+    int chunk = size < chunk_size ? size : chunk_size;
+    addr += chunk;
+    size -= chunk;
+    set_prog_arg(11, addr);
+    run_prog_slow();
+  }
+  return fetch_gpr(12);
+}
+
+//------------------------------------------------------------------------------
+// Finds the first copy of 'pattern' in [addr, addr + size). The target only
+// matches the first (up to) four bytes, anything longer is confirmed by
+// reading the candidate back and the scan restarts past it if that fails.
+
+bool RVDebug::search_mem(uint32_t addr, int size, const void* pattern, int len, uint32_t& found) {
+  const uint8_t* pat = (const uint8_t*)pattern;
+  if (len <= 0 || size < len) return false;
+
+  int k = len < 4 ? len : 4;
+  uint32_t end = addr + size - (len - k);
+
+  for (uint32_t start = addr; start + k <= end;) {
+    uint32_t match;
+    if (!search_prefix(start, end, pat, k, match)) return false;
+
+    bool confirmed = true;
+    for (int i = k; i < len && confirmed;) {
+      uint8_t buf[64];
+      int chunk = len - i < int(sizeof(buf)) ? len - i : int(sizeof(buf));
+      get_block_unaligned(match + i, buf, chunk);
+      confirmed = memcmp(buf, pat + i, chunk) == 0;
+      i += chunk;
     }
-    if (i == size_dwords - 1) {
-      set_abstractauto(0x00000000);
+    if (confirmed) {
+      found = match;
+      return true;
     }
+    start = match + 1;
   }
+  return false;
+}
+
+//----------------------------------------
+// Matches the k <= 4 byte prefix 'pat' starting anywhere in [start, end - k].
+// The program keeps the last four bytes it loaded in A5 and compares the top
+// k of them against A2, so one run checks every position with one load. We
+// prime A5 with the first k - 1 bytes so the first compare is at 'start'.
+
+bool RVDebug::search_prefix(uint32_t start, uint32_t end, const uint8_t* pat, int k, uint32_t& match) {
+  static constexpr Prog prog_search = assemble<
+    label(0),
+    lbu(a4, 0, a0),
+    c_srli(a5, 8),
+    c_slli(a4, 24),
+    c_or(a5, a4),
+    c_addi(a0, 1),
+    srl(a4, a5, a3),
+    beq(a4, a2, L(1)),
+    bltu(a0, a1, L(0)),
+    label(1)
+  >();
+
+  const int chunk_size = 4096;
+
+  if (!fits(prog_search)) {
+    uint8_t buf[256];
+    while (start + k <= end) {
+      int chunk = end - start < sizeof(buf) ? end - start : sizeof(buf);
+      get_block_unaligned(start, buf, chunk);
+      for (int i = 0; i + k <= chunk; i++) {
+        if (memcmp(buf + i, pat, k) == 0) {
+          match = start + i;
+          return true;
+        }
+      }
+      start += chunk - (k - 1);
+    }
+    return false;
+  }
+
+  uint32_t key = 0;
+  for (int i = 0; i < k; i++) key |= uint32_t(pat[i]) << (8 * i);
+
+  uint8_t head[3];
+  uint32_t window = 0;
+  if (k > 1) get_block_unaligned(start, head, k - 1);
+  for (int i = 0; i < k - 1; i++) window = (window >> 8) | (uint32_t(head[i]) << 24);
+
+  load_prog("search", prog_search, BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3 | BIT_A4 | BIT_A5);
+  set_prog_arg(10, start + k - 1);
+  set_prog_arg(12, key);
+  set_prog_arg(13, 32 - 8 * k);
+  set_prog_arg(15, window);
+
+  for (uint32_t cursor = start + k - 1; cursor < end;) {
+    cursor = end - cursor > uint32_t(chunk_size) ? cursor + chunk_size : end;
+    set_prog_arg(11, cursor);
+    run_prog_slow();
+    if (fetch_gpr(14) == key) {
+      match = fetch_gpr(10) - k;
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+
+void RVDebug::reset_stats() {
+  if (stats) dmi->call([](void* s) { ((DMIStats*)s)->reset(); }, stats);
 }
 
 //------------------------------------------------------------------------------
@@ -671,7 +1419,7 @@ void RVDebug::dump() {
 
   auto actual_halted = get_dmstatus().ALLHALTED;
 
-  printf_b("prog_cache\n");
+  printf_b("prog_cache (hash 0x%08x)\n", prog_hash);
   printf("  0x%08x  0x%08x  0x%08x  0x%08x  0x%08x  0x%08x  0x%08x  0x%08x\n",
          prog_cache[0], prog_cache[1], prog_cache[2], prog_cache[3],
          prog_cache[4], prog_cache[5], prog_cache[6], prog_cache[7]);
@@ -3,13 +3,17 @@
 // registers to reduce traffic on the DMI bus.
 
 // Should _not_ contain anything platform- or chip-specific.
-// Memory access methods assum the target has at least 8 prog registers
-// FIXME - currently assuming we have exactly 8 prog registers
-// FIXME - should check actual number of prog registers at startup...
+// init() reads the progbuf size, data register count and data address from
+// the debug module. Memory access uses programs written for the CH32V003's
+// 8 progbuf words and memory-mapped DATA0/DATA1 when the target has them, and
+// falls back to one-word programs that only need DATA0 otherwise. The
+// programs themselves are written with the assembler in RVAsm.h.
 
 #pragma once
 #include <stdint.h>
 #include "Bus.h"
+#include "DMIStats.h"
+#include "RVAsm.h"
 
 #define BIT_T0 (1 <<  5)
 #define BIT_T1 (1 <<  6)
@@ -45,6 +49,7 @@ struct RVDebug {
   bool halt();
   bool resume();
   bool step();
+  bool step_n(int count);
 
   bool reset();
   bool clear_err();
@@ -54,7 +59,9 @@ struct RVDebug {
   //----------
   // Run small (32 byte on CH32V003) programs from the debug program buffer
 
-  void load_prog(const char* name, uint32_t* prog, uint32_t clobbers);
+  // Uploads only the words that differ from what's already in the progbuf,
+  // and nothing at all if the program is the resident one.
+  void load_prog(const char* name, const rvasm::Prog& prog, uint32_t clobbers);
   void run_prog(bool wait_until_not_busy);
   void run_prog_slow() { run_prog(true); }
   void run_prog_fast() { run_prog(false); }
@@ -73,6 +80,11 @@ struct RVDebug {
   uint32_t         get_prog(int i);
   uint32_t         get_haltsum0();
 
+  // Read DMSTATUS/ABSTRACTCS until the condition holds. The polling happens
+  // on the bus, so it can run back-to-back on the wire.
+  Reg_DMSTATUS     wait_dmstatus(uint32_t mask, uint32_t expect);
+  Reg_ABSTRACTCS   wait_not_busy();
+
   void set_data0(uint32_t d);
   void set_data1(uint32_t d);
   void set_dmcontrol(Reg_DMCONTROL r);
@@ -97,12 +109,24 @@ struct RVDebug {
   void set_dscratch1(uint32_t r);
 
   //----------
-  // CPU register access
+  // CPU register access. Index 16 is DPC.
 
+  // GPRs and DPC are cached while the hart is halted - each register is read
+  // over the bus at most once per stop, and writes are held until the next
+  // resume/step.
   int      get_gpr_count() { return reg_count; }
   uint32_t get_gpr(int index);
   void     set_gpr(int index, uint32_t gpr);
 
+  // All GPRs followed by DPC, in GDB 'g' packet order.
+  void     get_gprs(uint32_t* regs);
+  void     set_gprs(const uint32_t* regs);
+
+  // Loads an input register for the program that was just loaded. The
+  // register must be one the program clobbers, so the cached value gets
+  // restored on resume.
+  void     set_prog_arg(int index, uint32_t data);
+
   //----------
   // CSR access
 
@@ -126,24 +150,102 @@ struct RVDebug {
   void get_block_aligned  (uint32_t addr, void* data, int size);
   void set_block_aligned  (uint32_t addr, void* data, int size);
 
+  // Any address and size. Bytes next to the range in its first and last
+  // words are read and written back unchanged.
+  void get_block_unaligned(uint32_t addr, void* data, int size);
+  void set_block_unaligned(uint32_t addr, void* data, int size);
+
+  // memset()/memcpy() run by the target itself, a few frames regardless of
+  // size. copy_mem() copies forwards, so dst must not be inside (src, src+size).
+  void fill_mem(uint32_t addr, uint8_t value, int size);
+  void copy_mem(uint32_t dst, uint32_t src, int size);
+
+  // GDB's CRC-32 of target memory, computed on the target.
+  uint32_t crc32(uint32_t addr, int size, uint32_t crc = 0xFFFFFFFF);
+
+  // Finds the first copy of 'pattern' in target memory, scanning on the target.
+  bool search_mem(uint32_t addr, int size, const void* pattern, int len, uint32_t& found);
+
+  //----------
+  // Debug module shape, as read by init()
+
+  int      get_progbuf_size() const { return progbuf_size; }
+  int      get_data_count() const   { return data_count; }
+  uint32_t get_data_addr() const    { return data_addr; } // 0 if not memory-mapped
+
+  // Optional, load_prog() counts program uploads here.
+  DMIStats* stats = nullptr;
+
+  // Clears 'stats' in order with the DMI traffic, so a bus running on the
+  // other core isn't counting into it at the same time.
+  void reset_stats();
+
 private:
 
   uint32_t get_mem_u32_aligned(uint32_t addr);
   void     set_mem_u32_aligned(uint32_t addr, uint32_t data);
+  void     set_mem_u32_pair(uint32_t addr, uint32_t* src);
+  void     check_block_status(const char* name);
+
+  // Variants for debug modules without the CH32V003's progbuf and data layout
+  uint32_t get_mem_u32_small(uint32_t addr);
+  void     set_mem_u32_small(uint32_t addr, uint32_t data);
+  void     get_block_small(uint32_t addr, uint32_t* dst, int size_dwords);
+  void     set_block_small(uint32_t addr, const uint32_t* src, int size_dwords);
+  void     probe_dm();
+  bool     search_prefix(uint32_t start, uint32_t end, const uint8_t* pat, int k, uint32_t& match);
+  bool     fits(const rvasm::Prog& prog) const { return prog.size <= progbuf_size; }
+  bool     is_hot(uint32_t addr, bool write);
   void reload_regs();
+  void set_step(bool step);
+
+  // Uncached register access over the bus
+  uint32_t fetch_gpr(int index);
+  void     store_gpr(int index, uint32_t gpr);
+
+  // Streamed restore of x1-x15 on RV32E, see prog_shift_down().
+  void     store_gprs_bulk(uint32_t mask);
+  int      prog_upload_cost(const rvasm::Prog& prog);
 
   Bus* dmi;
 
+  // Reads per Bus::poll() call before we check back in.
+  static const int poll_iters = 1000;
+
   // Cached target state, must stay in sync
   int reg_count;
 
   uint32_t prog_cache[8];
+  uint32_t prog_hash = 0; // Prog::hash of the resident program, 0 if unknown
   uint32_t prog_will_clobber = 0; // Bits are 1 if running the current program will clober the reg
 
 
+  // reg_cache holds the registers as the debugger sees them. A dirty reg is
+  // one where the device copy doesn't match - either a program clobbered it
+  // or we have a buffered write - and it's always cached.
   uint32_t reg_cache[32];
-  uint32_t dirty_regs = 0;  // bits are 1 if we modified the reg on device
+  uint32_t dirty_regs = 0;  // bits are 1 if the reg on device is stale
   uint32_t cached_regs = 0; // bits are 1 if reg_cache[i] is valid
+
+  uint32_t dcsr_cache = 0;
+  bool     dcsr_cached = false;
+
+  int      progbuf_size = 8;          // ABSTRACTCS.PROGBUFSIZE
+  int      data_count = 2;            // ABSTRACTCS.DATACOUNT
+  uint32_t data_addr = 0xE00000F4;    // DATA0 in the hart's address space
+  bool     small_progs = false;       // true if the CH32V003 programs won't run
+  bool     tail_ebreak = false;       // true once PROGBUF8 holds an ebreak
+
+  // Single-word accesses to an address that's been hit this many times get
+  // a program with the address built in.
+  struct HotAddr {
+    uint32_t addr;
+    uint8_t  hits;
+    bool     write;
+  };
+  static const int hot_count = 4;
+  static const int hot_threshold = 8;
+  HotAddr hot_addrs[hot_count] = {};
 };
 
 //------------------------------------------------------------------------------
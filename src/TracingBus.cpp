@@ -0,0 +1,104 @@
+#include "TracingBus.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include "hardware/timer.h"
+
+//------------------------------------------------------------------------------
+
+void TracingBus::record(uint8_t op, uint32_t addr, uint32_t data, int count) {
+  if (!enabled) return;
+  if (head >= ring_size) dropped++;
+  ring[head & (ring_size - 1)] = { time_us_32(), data, op, uint8_t(addr), uint16_t(count) };
+  head++;
+}
+
+void TracingBus::clear() {
+  head = 0;
+  dropped = 0;
+}
+
+int TracingBus::size() const {
+  return head < ring_size ? head : ring_size;
+}
+
+const TraceRecord& TracingBus::at(int i) const {
+  uint32_t first = head < ring_size ? 0 : head - ring_size;
+  return ring[(first + i) & (ring_size - 1)];
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t TracingBus::get(uint32_t addr) {
+  uint32_t data = target->get(addr);
+  record(TraceRecord::GET, addr, data);
+  return data;
+}
+
+void TracingBus::put(uint32_t addr, uint32_t data) {
+  record(TraceRecord::PUT, addr, data);
+  target->put(addr, data);
+}
+
+// Batches still go down as batches, the trace just sees the individual ops.
+void TracingBus::transact(const DmiOp* ops, int count, uint32_t* results) {
+  target->transact(ops, count, results);
+  for (int i = 0; i < count; i++) {
+    if (ops[i].write) {
+      record(TraceRecord::PUT, ops[i].addr, ops[i].data);
+    }
+    else {
+      record(TraceRecord::GET, ops[i].addr, *results++);
+    }
+  }
+}
+
+// Repeats longer than a record can hold are split.
+void TracingBus::get_repeat(uint32_t addr, uint32_t* data, int count) {
+  target->get_repeat(addr, data, count);
+  for (int i = 0; i < count; i += 0xFFFF) {
+    int n = count - i < 0xFFFF ? count - i : 0xFFFF;
+    record(TraceRecord::REPEAT, addr, data[i], n);
+  }
+}
+
+// Polls record how many reads they took, so the replay can put them all back.
+uint32_t TracingBus::poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) {
+  int n = 0;
+  uint32_t data = target->poll(addr, mask, expect, max_iters, &n);
+  record(TraceRecord::POLL, addr, data, n < 0xFFFF ? n : 0xFFFF);
+  if (reads) *reads = n;
+  return data;
+}
+
+//------------------------------------------------------------------------------
+
+void TracingBus::mark(const char* tag) {
+  uint32_t packed = 0;
+  for (int i = 0; i < 4 && isalpha(tag[i]); i++) {
+    packed |= uint32_t(uint8_t(tag[i])) << (8 * i);
+  }
+  record(TraceRecord::MARK, 0, packed);
+}
+
+//------------------------------------------------------------------------------
+
+void TracingBus::dump() {
+  printf("trace begin %d dropped %u\n", size(), dropped);
+  for (int i = 0; i < size(); i++) {
+    auto& r = at(i);
+    printf("TR %08x %08x %02x %02x %04x\n", r.time, r.data, r.op, r.addr, r.count);
+  }
+  printf("trace end\n");
+}
+
+bool TracingBus::parse(const char* line, TraceRecord& r) {
+  unsigned time, data, op, addr, count;
+  if (sscanf(line, "TR %x %x %x %x %x", &time, &data, &op, &addr, &count) != 5) return false;
+  if (op > TraceRecord::MARK) return false;
+  r = { time, data, uint8_t(op), uint8_t(addr), uint16_t(count) };
+  return true;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,69 @@
+// Bus decorator that records every DMI op as a compact binary record in a ring
+// buffer. A captured session can be dumped over the console and replayed on
+// the host (see host/replay.cpp) to measure traffic offline.
+
+#pragma once
+#include <stdint.h>
+#include "Bus.h"
+
+//------------------------------------------------------------------------------
+
+struct TraceRecord {
+  enum Op : uint8_t { GET, PUT, REPEAT, POLL, MARK };
+
+  uint32_t time;   // usec when the op was issued
+  uint32_t data;   // value read or written, first value of a repeat, mark tag
+  uint8_t  op;
+  uint8_t  addr;
+  uint16_t count;  // reads in a REPEAT or POLL, 1 otherwise
+};
+static_assert(sizeof(TraceRecord) == 12);
+
+//------------------------------------------------------------------------------
+
+struct TracingBus : public Bus {
+  TracingBus(Bus* target) : target(target) {}
+
+  uint32_t get(uint32_t addr) override;
+  void     put(uint32_t addr, uint32_t data) override;
+  void     transact(const DmiOp* ops, int count, uint32_t* results) override;
+  void     get_repeat(uint32_t addr, uint32_t* data, int count) override;
+  uint32_t poll(uint32_t addr, uint32_t mask, uint32_t expect, int max_iters, int* reads) override;
+  void     invalidate() override { target->invalidate(); }
+  void     call(void (*fn)(void*), void* arg) override { target->call(fn, arg); }
+
+  // Starts a new phase in the trace. The leading letters of 'tag' (up to 4)
+  // are packed into the record, so a GDB packet like "m20000000,4" marks
+  // phase "m".
+  void mark(const char* tag);
+
+  void start() { enabled = true; }
+  void stop()  { enabled = false; }
+  void clear();
+
+  // Records currently in the ring, oldest first.
+  int size() const;
+  const TraceRecord& at(int i) const;
+
+  // Prints the trace one hex record per line between "trace begin"/"trace end"
+  // lines, so it can be captured from a serial log.
+  void dump();
+
+  // Parses one record line from dump(). Returns false for any other line.
+  static bool parse(const char* line, TraceRecord& r);
+
+  bool     enabled = false;
+  uint32_t dropped = 0; // records overwritten since clear()
+
+private:
+  void record(uint8_t op, uint32_t addr, uint32_t data, int count = 1);
+
+  static const int ring_size = 2048;
+  static_assert((ring_size & (ring_size - 1)) == 0);
+
+  Bus*        target;
+  TraceRecord ring[ring_size];
+  uint32_t    head = 0; // records written since clear()
+};
+
+//------------------------------------------------------------------------------
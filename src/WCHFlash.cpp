@@ -1,9 +1,12 @@
 #include "WCHFlash.h"
 #include "utils.h"
 #include "RVDebug.h"
+#include "RVAsm.h"
 
 #include "pico/stdlib.h"
 
+using namespace rvasm;
+
 const uint32_t ADDR_ESIG_FLACAP  = 0x1FFFF7E0; // Flash capacity register 0xXXXX
 const uint32_t ADDR_ESIG_UNIID1  = 0x1FFFF7E8; // UID register 1 0xXXXXXXXX
 const uint32_t ADDR_ESIG_UNIID2  = 0x1FFFF7EC; // UID register 2 0xXXXXXXXX
@@ -242,47 +245,55 @@ void WCHFlash::write_flash(uint32_t dst_addr, void* blob, int size) {
 
   dst_addr |= 0x08000000;
 
-  static const uint16_t prog_write_flash[16] = {
+  // Fills all 32 bytes, the implicit ebreak after the progbuf ends it.
+  static constexpr Prog prog_write_flash = assemble<
     // Copy word and trigger BUFLOAD
-    0x4180, // lw      s0,0(a1)
-    0xc200, // sw      s0,0(a2)
-    0xc914, // sw      a3,16(a0)
+    c_lw(s0, 0, a1),
+    c_sw(s0, 0, a2),
+    c_sw(a3, 16, a0),
 
-    // waitloop1: Busywait for copy to complete - this seems to be required now?
-    0x4540, // lw      s0,12(a0)
-    0x8805, // andi    s0,s0,1
-    0xfc75, // bnez    s0, <waitloop1>
+    // Busywait for copy to complete - this seems to be required now?
+    label(0),
+    c_lw(s0, 12, a0),
+    c_andi(s0, 1),
+    c_bnez(s0, L(0)),
 
     // Advance dest pointer and trigger START if we ended a page
-    0x0611, // addi    a2,a2,4
-    0x7413, // andi    s0,a2,63
-    0x03f6, //
-    0xe419, // bnez    s0, <end>
-    0xc918, // sw      a4,16(a0)
+    c_addi(a2, 4),
+    andi(s0, a2, 63),
+    c_bnez(s0, L(2)),
+    c_sw(a4, 16, a0),
 
-    // waitloop2: Busywait for page write to complete
-    0x4540, // lw      s0,12(a0)
-    0x8805, // andi    s0,s0,1
-    0xfc75, // bnez    s0, <waitloop2>
+    // Busywait for page write to complete
+    label(1),
+    c_lw(s0, 12, a0),
+    c_andi(s0, 1),
+    c_bnez(s0, L(1)),
 
     // Reset buffer, don't need busywait as it'll complete before we send the
     // next dword.
-    0xc91c, // sw      a5,16(a0)
+    c_sw(a5, 16, a0),
 
     // Update page address
-    0xc950, // sw      a2,20(a0)
-  };
+    c_sw(a2, 20, a0),
+    label(2)
+  >();
+
+  if (prog_write_flash.size > rvd->get_progbuf_size() || !rvd->get_data_addr()) {
+    write_flash_small(dst_addr, (uint32_t*)blob, size_dwords);
+    return;
+  }
 
   rvd->set_mem_u32(ADDR_FLASH_ADDR, dst_addr);
   rvd->set_mem_u32(ADDR_FLASH_CTLR, BIT_CTLR_FTPG | BIT_CTLR_BUFRST);
 
-  rvd->load_prog("write_flash", (uint32_t*)prog_write_flash, BIT_S0 | BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3 | BIT_A4 | BIT_A5);
-  rvd->set_gpr(10, 0x40022000); // flash base
-  rvd->set_gpr(11, 0xE00000F4); // DATA0 @ 0xE00000F4
-  rvd->set_gpr(12, dst_addr);
-  rvd->set_gpr(13, BIT_CTLR_FTPG | BIT_CTLR_BUFLOAD);
-  rvd->set_gpr(14, BIT_CTLR_FTPG | BIT_CTLR_STRT);
-  rvd->set_gpr(15, BIT_CTLR_FTPG | BIT_CTLR_BUFRST);
+  rvd->load_prog("write_flash", prog_write_flash, BIT_S0 | BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3 | BIT_A4 | BIT_A5);
+  rvd->set_prog_arg(10, 0x40022000); // flash base
+  rvd->set_prog_arg(11, rvd->get_data_addr()); // DATA0, 0xE00000F4 on CH32V003
+  rvd->set_prog_arg(12, dst_addr);
+  rvd->set_prog_arg(13, BIT_CTLR_FTPG | BIT_CTLR_BUFLOAD);
+  rvd->set_prog_arg(14, BIT_CTLR_FTPG | BIT_CTLR_STRT);
+  rvd->set_prog_arg(15, BIT_CTLR_FTPG | BIT_CTLR_BUFRST);
 
   bool first_word = true;
   int page_count = (size_dwords + 15) / 16;
@@ -314,7 +325,7 @@ void WCHFlash::write_flash(uint32_t dst_addr, void* blob, int size) {
         // of each page, but I am wary...
         // Waiting here takes 54443 us to write 564 bytes
         //uint32_t time_a = time_us_32();
-        while (rvd->get_abstractcs().BUSY) {}
+        rvd->wait_not_busy();
         //uint32_t time_b = time_us_32();
         //busy_time += time_b - time_a;
       }
@@ -347,6 +358,13 @@ bool WCHFlash::verify_flash(uint32_t dst_addr, void* blob, int size) {
 
   dst_addr |= 0x08000000;
 
+  // The target checksums its flash, we only read it back to find out where a
+  // mismatch is.
+  if (rvd->crc32(dst_addr, size) == update_crc32(0xFFFFFFFF, blob, size)) {
+    LOG("WCHFlash::verify_flash() done\n");
+    return true;
+  }
+
   uint8_t* readback = new uint8_t[size];
   rvd->get_block_aligned(dst_addr, readback, size);
 
@@ -427,37 +445,72 @@ void WCHFlash::dump() {
   */
 }
 
+//------------------------------------------------------------------------------
+// The same page buffer sequence as prog_write_flash, one debugger memory access
+// at a time, for debug modules that can't hold the program or don't map DATA0
+// into memory.
+
+void WCHFlash::write_flash_small(uint32_t dst_addr, uint32_t* src, int size_dwords) {
+  rvd->set_mem_u32(ADDR_FLASH_ADDR, dst_addr);
+  rvd->set_mem_u32(ADDR_FLASH_CTLR, BIT_CTLR_FTPG | BIT_CTLR_BUFRST);
+
+  int page_count = (size_dwords + 15) / 16;
+  for (int page = 0; page < page_count; page++) {
+    uint32_t page_addr = dst_addr + page * page_size;
+    for (int i = 0; i < 16; i++) {
+      int index = page * 16 + i;
+      rvd->set_mem_u32(page_addr + i * 4, index < size_dwords ? src[index] : 0xDEADBEEF);
+      rvd->set_mem_u32(ADDR_FLASH_CTLR, BIT_CTLR_FTPG | BIT_CTLR_BUFLOAD);
+      wait_flash_idle();
+    }
+    rvd->set_mem_u32(ADDR_FLASH_CTLR, BIT_CTLR_FTPG | BIT_CTLR_STRT);
+    wait_flash_idle();
+    rvd->set_mem_u32(ADDR_FLASH_CTLR, BIT_CTLR_FTPG | BIT_CTLR_BUFRST);
+    rvd->set_mem_u32(ADDR_FLASH_ADDR, page_addr + page_size);
+  }
+
+  rvd->set_mem_u32(ADDR_FLASH_CTLR, 0);
+
+  auto statr = Reg_FLASH_STATR(rvd->get_mem_u32(ADDR_FLASH_STATR));
+  statr.EOP = 1;
+  rvd->set_mem_u32(ADDR_FLASH_STATR, statr);
+}
+
+void WCHFlash::wait_flash_idle() {
+  while (Reg_FLASH_STATR(rvd->get_mem_u32(ADDR_FLASH_STATR)).BUSY) {}
+}
+
 //------------------------------------------------------------------------------
 
 void WCHFlash::run_flash_command(uint32_t addr, uint32_t ctl1, uint32_t ctl2) {
-  static const uint16_t prog_flash_command[16] = {
-    0xc94c, // sw      a1,20(a0)
-    0xc910, // sw      a2,16(a0)
-    0xc914, // sw      a3,16(a0)
-
-    // waitloop:
-    0x455c, // lw      a5,12(a0)
-    0x8b85, // andi    a5,a5,1
-    0xfff5, // bnez    a5, <waitloop>
-
-    0x2823, // sw      zero,16(a0)
-    0x0005, //
-
-    0x9002, // ebreak
-    0x9002, // ebreak
-    0x9002, // ebreak
-    0x9002, // ebreak
-    0x9002, // ebreak
-    0x9002, // ebreak
-    0x9002, // ebreak
-    0x9002, // ebreak
-  };
+  static constexpr Prog prog_flash_command = assemble<
+    c_sw(a1, 20, a0),
+    c_sw(a2, 16, a0),
+    c_sw(a3, 16, a0),
+
+    // Busywait for the command to finish
+    label(0),
+    c_lw(a5, 12, a0),
+    c_andi(a5, 1),
+    c_bnez(a5, L(0)),
+
+    sw(zero, 16, a0)
+  >();
+
+  if (prog_flash_command.size > rvd->get_progbuf_size()) {
+    rvd->set_mem_u32(ADDR_FLASH_ADDR, addr);
+    rvd->set_mem_u32(ADDR_FLASH_CTLR, ctl1);
+    rvd->set_mem_u32(ADDR_FLASH_CTLR, ctl2);
+    wait_flash_idle();
+    rvd->set_mem_u32(ADDR_FLASH_CTLR, 0);
+    return;
+  }
 
-  rvd->load_prog("flash_command", (uint32_t*)prog_flash_command, BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3 | BIT_A5);
-  rvd->set_gpr(10, 0x40022000);   // flash base
-  rvd->set_gpr(11, addr);
-  rvd->set_gpr(12, ctl1);
-  rvd->set_gpr(13, ctl2);
+  rvd->load_prog("flash_command", prog_flash_command, BIT_A0 | BIT_A1 | BIT_A2 | BIT_A3 | BIT_A5);
+  rvd->set_prog_arg(10, 0x40022000);   // flash base
+  rvd->set_prog_arg(11, addr);
+  rvd->set_prog_arg(12, ctl1);
+  rvd->set_prog_arg(13, ctl2);
   rvd->run_prog_slow();
 }
 
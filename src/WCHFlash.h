@@ -35,6 +35,8 @@ struct WCHFlash {
 
 private:
   void run_flash_command(uint32_t addr, uint32_t ctl1, uint32_t ctl2);
+  void write_flash_small(uint32_t dst_addr, uint32_t* src, int size_dwords);
+  void wait_flash_idle();
 
   RVDebug* rvd;
   const int flash_size;
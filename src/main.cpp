@@ -4,6 +4,9 @@
 #include "tusb.h"
 
 #include "PicoSWIO.h"
+#include "QueueBus.h"
+#include "TracingBus.h"
+#include "CachingBus.h"
 #include "RVDebug.h"
 #include "WCHFlash.h"
 #include "SoftBreak.h"
@@ -16,6 +19,14 @@ const int PIN_SWIO = 28;
 const int PIN_UART_TX = 0;
 const int PIN_UART_RX = 1;
 const int ch32v003_flash_size = 16*1024;
+const int sys_clock_khz = 125000; // SWIO timing follows clk_sys, so this can go up to ~250 mhz
+
+static bool tud_init_done = false;
+
+// Keeps USB serviced while core0 waits on the SWIO engine.
+void usb_idle() {
+  if (tud_init_done) tud_task();
+}
 
 void delay_us(int us) {
   auto now = time_us_32();
@@ -25,6 +36,8 @@ void delay_us(int us) {
 //------------------------------------------------------------------------------
 
 int main() {
+  set_sys_clock_khz(sys_clock_khz, true);
+
   // Enable non-USB serial port on gpio 0/1 for meta-debug output :D
   stdio_uart_init_full(uart0, 1000000, PIN_UART_TX, PIN_UART_RX);
 
@@ -36,8 +49,21 @@ int main() {
   PicoSWIO* swio = new PicoSWIO();
   swio->reset(PIN_SWIO);
 
+  printf_g("// Starting QueueBus on core1\n");
+  QueueBus* queue = new QueueBus(swio);
+  queue->idle = usb_idle;
+  queue->start();
+
+  // Tracing is off until started from the console.
+  TracingBus* trace = new TracingBus(queue);
+
+  // The shadow cache sits above the trace, so traces show what actually goes
+  // out on the wire.
+  CachingBus* cache = new CachingBus(trace);
+
   printf_g("// Starting RVDebug\n");
-  RVDebug* rvd = new RVDebug(swio, 16);
+  RVDebug* rvd = new RVDebug(cache, 16);
+  rvd->stats = &swio->stats;
   rvd->init();
   //rvd->dump();
 
@@ -52,12 +78,13 @@ int main() {
   //soft->dump();
 
   printf_g("// Starting GDBServer\n");
-  GDBServer* gdb = new GDBServer(rvd, flash, soft);
+  GDBServer* gdb = new GDBServer(rvd, flash, soft, &swio->stats);
+  gdb->trace = trace;
   gdb->reset();
   //gdb->dump();
 
   printf_g("// Starting Console\n");
-  Console* console = new Console(rvd, flash, soft);
+  Console* console = new Console(rvd, flash, soft, swio, queue, trace);
   console->reset();
   //console->dump();
 
@@ -69,7 +96,6 @@ int main() {
     //----------------------------------------
     // Update TinyUSB
 
-    static bool tud_init_done = false;
     if (!tud_init_done) {
       tud_init(BOARD_TUD_RHPORT);
       tud_init_done = true;
@@ -111,3 +111,16 @@ char* atox(char* cursor, int& out) {
   out = sign * accum;
   return any_digits ? cursor : nullptr;
 }
+
+//------------------------------------------------------------------------------
+
+uint32_t update_crc32(uint32_t crc, const void* data, int size) {
+  const uint8_t* cursor = (const uint8_t*)data;
+  for (int i = 0; i < size; i++) {
+    crc ^= uint32_t(cursor[i]) << 24;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc << 1) ^ ((crc & 0x80000000) ? 0x04C11DB7 : 0);
+    }
+  }
+  return crc;
+}
@@ -53,10 +53,24 @@ void vprint_to(putter p, const char* fmt, va_list args);
 void print_to(putter p, const char* fmt, ...);
 char* atox(char* cursor, int& out);
 
+// GDB's CRC-32 - polynomial 0x04C11DB7, MSB first, no final inversion. Start
+// from 0xFFFFFFFF.
+uint32_t update_crc32(uint32_t crc, const void* data, int size);
+
 //#define CHECK(A, args...) if(!(A)) { printf_r("ASSERT FAIL %s %d\n", __FILE__, __LINE__); printf_r("" args); printf_r("\n"); while (1); }
 
+#ifdef PICORVD_CHECKS
+
+// Host test builds stop at the first failure.
+#include <stdlib.h>
+#define CHECK(A, args...) if(!(A)) { printf_r("ASSERT FAIL %s %d\n", __FILE__, __LINE__); printf_r("" args); printf_r("\n"); abort(); }
+
+#else
+
 #define CHECK(A, args...)
 
+#endif
+
 /*
 #define CHECK_EQ(A, B) { \
   auto _a = (A); \
@@ -108,6 +108,85 @@ void run_tests(RVDebug& rvd) {
   }
   CHECK(rvd.get_abstractcs().CMDER == 0);
 
+  // Test unaligned block writes
+  for (int size = 1; size <= 9; size++) {
+    for (int offset = 1; offset <= 3; offset++) {
+      for (int i = 0; i < 4; i++) {
+        rvd.set_mem_u32(base + (4 * i), 0xFFFFFFFF);
+      }
+
+      uint8_t buf[9] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09 };
+      rvd.set_block_unaligned(base + offset, buf, size);
+
+      for (int i = 0; i < offset; i++)         CHECK(rvd.get_mem_u8(base + i) == 0xFF);
+      for (int i = 0; i < size; i++)           CHECK(rvd.get_mem_u8(base + i + offset) == i + 1);
+      for (int i = offset + size; i < 16; i++) CHECK(rvd.get_mem_u8(base + i) == 0xFF);
+    }
+  }
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+
+  // Test unaligned block reads
+  for (int i = 0; i < 16; i++) rvd.set_mem_u8(base + i, i + 1);
+  for (int size = 1; size <= 9; size++) {
+    for (int offset = 1; offset <= 3; offset++) {
+      uint8_t buf[16];
+      memset(buf, 0xFF, sizeof(buf));
+
+      rvd.get_block_unaligned(base + offset, buf + 4, size);
+
+      for (int i = 0;        i < 4;        i++) CHECK(buf[i] == 0xFF);
+      for (int i = 4;        i < 4 + size; i++) CHECK(buf[i] == i + offset - 3);
+      for (int i = 4 + size; i < 16;       i++) CHECK(buf[i] == 0xFF);
+    }
+  }
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+
+  // Test target-side fill and copy, word loops when aligned and bytes when not
+  for (int offset = 0; offset < 4; offset++) {
+    int size = 20 + offset;
+    uint8_t buf[64];
+
+    memset(buf, 0xFF, sizeof(buf));
+    rvd.set_block_aligned(base, buf, sizeof(buf));
+    rvd.fill_mem(base + offset, 0x5A, size);
+    rvd.get_block_aligned(base, buf, sizeof(buf));
+    for (int i = 0; i < 32; i++) {
+      CHECK(buf[i] == ((i >= offset && i < offset + size) ? 0x5A : 0xFF));
+    }
+
+    for (int i = 0; i < 32; i++) buf[i] = i + 1;
+    rvd.set_block_aligned(base, buf, 32);
+    rvd.copy_mem(base + 32 + offset, base, size);
+    rvd.get_block_aligned(base, buf, sizeof(buf));
+    for (int i = 0; i < 32; i++) {
+      CHECK(buf[32 + i] == ((i >= offset && i < offset + size) ? i - offset + 1 : 0xFF));
+    }
+  }
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+
+  // Test target-side CRC against the CRC-32/MPEG-2 check value, which is the
+  // same CRC GDB uses
+  rvd.set_block_unaligned(base + 1, (void*)"123456789", 9);
+  CHECK(rvd.crc32(base + 1, 9) == 0x0376E6E7);
+  CHECK(rvd.crc32(base + 1, 9) == update_crc32(0xFFFFFFFF, "123456789", 9));
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+
+  // Test target-side search - short patterns, a long pattern whose prefix also
+  // shows up earlier, and misses
+  {
+    const char* text = "xxabcdefgxabcdeXYZabcdefgh";
+    uint32_t found = 0;
+    rvd.set_block_unaligned(base + 1, (void*)text, 26);
+    CHECK(rvd.search_mem(base, 32, "a", 1, found) && found == base + 3);
+    CHECK(rvd.search_mem(base, 32, "XYZ", 3, found) && found == base + 16);
+    CHECK(rvd.search_mem(base, 32, "abcdefgh", 8, found) && found == base + 19);
+    CHECK(rvd.search_mem(base + 4, 28, "abcd", 4, found) && found == base + 11);
+    CHECK(!rvd.search_mem(base, 32, "abcdefghi", 9, found));
+    CHECK(!rvd.search_mem(base, 18, "XYZ", 3, found));
+    CHECK(rvd.search_mem(base, 19, "XYZ", 3, found) && found == base + 16);
+  }
+  CHECK(rvd.get_abstractcs().CMDER == 0);
+
   // Test block writes at both ends of memory
   {
     uint32_t block[4] = { 0xDEADBEEF, 0xDEADBEEF, 0xDEADBEEF, 0xDEADBEEF };